@@ -43,20 +43,57 @@ const float conf_threshold = 0.4;
 const float iou_threshold = 0.5;
 const int max_hw = 4096;
 
+// rectangular inference: pad to the smallest stride aligned shape instead of the full input square
+const bool rect_inference = true;
+const int model_stride = 32;
+
+// write a chrome trace (open in chrome://tracing) and per-op table of the detection
+const bool enable_profiler = false;
+const char *profiler_trace_path = "detect_trace.json";
+
 TorchDevice device = {TorchDeviceType_CPU};
 
+// input shapes of the model (square, 16:9, 4:3 and portrait 9:16 at stride alignment), each shape costs
+// a re-specialization, so all of them are warmed up before the first real frame
+const std::vector<cv::Size> shape_buckets = {cv::Size(input_width, input_height), cv::Size(640, 384),
+                                             cv::Size(640, 480), cv::Size(384, 640)};
+
+
+cv::Size select_input_shape(const cv::Size &in) {
+    if (!rect_inference) {
+        return {input_width, input_height};
+    }
+    float scale = std::min(float(input_width) / float(in.width), float(input_height) / float(in.height));
+    auto align = [](float n) {
+        return int(std::ceil(std::round(n) / float(model_stride))) * model_stride;
+    };
+    cv::Size shape(align(float(in.width) * scale), align(float(in.height) * scale));
+
+    // reuse the smallest bucket that can hold the frame
+    const cv::Size *best = nullptr;
+    for (const auto &bucket: shape_buckets) {
+        if (bucket.width >= shape.width && bucket.height >= shape.height &&
+            (best == nullptr || bucket.area() < best->area())) {
+            best = &bucket;
+        }
+    }
+    return best != nullptr ? *best : cv::Size(input_width, input_height);
+}
+
 
 void pre_process(const cv::Mat &in, cv::Mat &out, LetterboxInfo &letterboxInfo) {
 
     auto in_h = static_cast<float>(in.size().height);
     auto in_w = static_cast<float>(in.size().width);
 
-    float scale = std::min(float(input_width) / in_w, float(input_height) / in_h);
+    cv::Size shape = select_input_shape(in.size());
+
+    float scale = std::min(float(shape.width) / in_w, float(shape.height) / in_h);
     int new_unpad_w = int(std::round(in_w * scale));
     int new_unpad_h = int(std::round(in_h * scale));
 
-    float dw = float(input_width - new_unpad_w) / 2.0f;
-    float dh = float(input_height - new_unpad_h) / 2.0f;
+    float dw = float(shape.width - new_unpad_w) / 2.0f;
+    float dh = float(shape.height - new_unpad_h) / 2.0f;
 
     cv::resize(in, out, cv::Size(new_unpad_w, new_unpad_h));
 
@@ -105,8 +142,8 @@ void restore_bounding_box_size(const cv::Rect &src, const LetterboxInfo &letterb
 
     int x1 = (int) std::round(float(src.tl().x - letterboxInfo.left_pad) / letterboxInfo.scale);  // x padding
     int y1 = (int) std::round(float(src.tl().y - letterboxInfo.top_pad) / letterboxInfo.scale);  // y padding
-    int x2 = (int) std::round(float(src.br().x - letterboxInfo.right_pad) / letterboxInfo.scale);  // x padding
-    int y2 = (int) std::round(float(src.br().y - letterboxInfo.down_pad) / letterboxInfo.scale);  // y padding
+    int x2 = (int) std::round(float(src.br().x - letterboxInfo.left_pad) / letterboxInfo.scale);  // x padding
+    int y2 = (int) std::round(float(src.br().y - letterboxInfo.top_pad) / letterboxInfo.scale);  // y padding
 
     x1 = clip(x1, 0, inputShape.width);
     y1 = clip(y1, 0, inputShape.height);
@@ -121,7 +158,9 @@ int detect(TorchModule module, const cv::Mat &input, float confidence_threshold,
 
     cv::Mat img;
     LetterboxInfo letterboxInfo{};
+    auto range = torch_profiler_range_push("example::pre_process");
     pre_process(input, img, letterboxInfo);
+    torch_profiler_range_pop(range);
 
 
     TorchBlob blob = {img.data, 1, img.channels(), img.size().height, img.size().width};
@@ -163,7 +202,9 @@ int detect(TorchModule module, const cv::Mat &input, float confidence_threshold,
     torch_tensor_delete(value);
 
     std::vector<int> nms_indices;
+    range = torch_profiler_range_push("example::nms");
     non_maximum_suppression(data, confidence_threshold, iou, nms_indices);
+    torch_profiler_range_pop(range);
 
     cv::Size inputShape = input.size();
     for (const auto &i: nms_indices) {
@@ -253,10 +294,16 @@ int main() {
 
     vector<string> names;
     vector<ObjectInfo> outputs;
-    //Empty inferences to warm up
+    //Empty inferences to warm up every input shape
     try {
-        cv::Mat tmp_image = cv::Mat::zeros(input_height, input_width, CV_32FC3);
-        int res = detect(module, tmp_image, 1.0, 1.0, outputs);
+        int res = 0;
+        for (const auto &bucket: shape_buckets) {
+            cv::Mat tmp_image = cv::Mat::zeros(bucket, CV_32FC3);
+            res = detect(module, tmp_image, 1.0, 1.0, outputs);
+            if (res != 0 || !rect_inference) {
+                break;
+            }
+        }
 
         if (res != 0) {
             torch_module_delete(module);
@@ -265,7 +312,21 @@ int main() {
         }
 
         outputs.clear();
+        if (enable_profiler) {
+            TorchProfilerOptions profilerOptions = {true, true, false};
+            torch_profiler_start(&profilerOptions, nullptr);
+        }
         res = detect(module, inputMat, conf_threshold, iou_threshold, outputs);
+        if (enable_profiler) {
+            char *table = nullptr;
+            if (torch_profiler_stop(profiler_trace_path, &table, &status) != 0) {
+                cerr << "profiler fail:" << status.msg << endl;
+                torch_status_clear(&status);
+            } else {
+                cout << table;
+                torch_profiler_table_delete(table);
+            }
+        }
 
         if (res != 0) {
             torch_module_delete(module);
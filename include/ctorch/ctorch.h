@@ -22,6 +22,13 @@ extern "C" {
 #include "torch_module.h"
 #include "torch_interpreter_value.h"
 #include "torch_tensor.h"
+#include "torch_cache.h"
+#include "torch_server.h"
+#include "torch_profiler.h"
+#include "torch_scheduler.h"
+#include "torch_allocator.h"
+#include "torch_image.h"
+#include "torch_reload.h"
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,67 @@
+// Copyright (c) 2023 Lynn <lynnplus90@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CTORCH_TORCH_ALLOCATOR_H
+#define CTORCH_TORCH_ALLOCATOR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#include "torch_core.h"
+
+typedef struct {
+    size_t max_cached_bytes; // maximum bytes of free blocks kept for reuse, 0:256MB
+    size_t min_block_bytes;  // smaller allocations bypass the cache
+    bool all_threads;        // cache allocations of every thread, otherwise only inside allocator scopes
+} TorchAllocatorOptions;
+
+typedef struct {
+    size_t allocations;  // allocations served by the cache
+    size_t reuses;       // allocations served by a cached free block (reuse rate = reuses / allocations)
+    size_t in_use_bytes;
+    size_t peak_bytes;   // peak of in_use_bytes
+    size_t cached_bytes; // free blocks kept for reuse
+} TorchAllocatorStats;
+
+/**
+ * install a caching cpu allocator that reuses freed intermediate tensor buffers of the same size,
+ * the allocator is process wide and installed once, calling again only updates the options
+ * @param options allocator options, nullptr:256MB cache and only inside allocator scopes
+ * @param status
+ * @return 0:success 1:error
+ */
+CTORCH_PUBLIC int torch_cpu_allocator_install(TorchAllocatorOptions *options, TorchStatus *status);
+
+/**
+ * enable the caching allocator for the current thread until @torch_cpu_allocator_scope_pop (scopes can nest),
+ * scheduler workers and the server inference thread always run inside a scope
+ */
+CTORCH_PUBLIC void torch_cpu_allocator_scope_push(void);
+CTORCH_PUBLIC void torch_cpu_allocator_scope_pop(void);
+
+CTORCH_PUBLIC void torch_cpu_allocator_stats(TorchAllocatorStats *stats);
+
+/**
+ * release all cached free blocks
+ */
+CTORCH_PUBLIC void torch_cpu_allocator_empty_cache(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //CTORCH_TORCH_ALLOCATOR_H
@@ -0,0 +1,73 @@
+// Copyright (c) 2023 Lynn <lynnplus90@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CTORCH_TORCH_CACHE_H
+#define CTORCH_TORCH_CACHE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#include "torch_core.h"
+#include "torch_tensor.h"
+
+typedef void *TorchResultCache;
+
+typedef struct {
+    size_t max_entries; // maximum number of cached results, 0:no limit
+    size_t max_bytes;   // maximum bytes of cached boxes, 0:no limit
+    int sample_stride;  // <=1:hash every pixel, >1:hash the mean of each stride x stride block
+    float tolerance;    // <=0:exact hash, >0:quantize pixel values by tolerance before hashing
+} TorchResultCacheOptions;
+
+typedef struct {
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t entries;
+    size_t bytes;
+} TorchResultCacheStats;
+
+/**
+ * create a LRU result cache keyed by the blob content and parse parameters, use @torch_result_cache_delete destroy
+ * @param options cache options, nullptr:no limit and exact hash
+ * @return
+ */
+CTORCH_PUBLIC TorchResultCache torch_result_cache_new(TorchResultCacheOptions *options);
+CTORCH_PUBLIC void torch_result_cache_delete(TorchResultCache obj);
+
+CTORCH_PUBLIC void torch_result_cache_clear(TorchResultCache obj);
+CTORCH_PUBLIC void torch_result_cache_stats(TorchResultCache obj, TorchResultCacheStats *stats);
+
+/**
+ * forward the blob and parse the result to bounding box array, a repeated blob returns the cached boxes
+ * without running the module (see @torch_module_forward_by_blob and @torch_tensor_parse_to_bbox).
+ * entries of a module are removed when it is deleted
+ * @param cache result cache, nullptr:always forward
+ * @param output return bounding box array (free by the @torch_tensor_result_box_delete when not needed)
+ * @param status result status, when an error occurs (code! =0)
+ * @return >0:outputs size ==0:no result or outputs is nil <0:error(for detailed errors, can view status)
+ */
+CTORCH_PUBLIC size_t
+torch_result_cache_detect(TorchResultCache cache, TorchModule module, TorchBlob *blob, TorchDevice *blobDevice,
+                          bool half, float confidence_threshold, int max_result_size, TensorResultBox **output,
+                          TorchStatus *status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //CTORCH_TORCH_CACHE_H
@@ -77,7 +77,8 @@ typedef enum {
     TorchScalarType_Half,
     TorchScalarType_Float,
     TorchScalarType_Double = 7,
-    TorchScalarType_Bool = 11
+    TorchScalarType_Bool = 11,
+    TorchScalarType_BFloat16 = 15
 } TorchScalarType;
 
 typedef struct {
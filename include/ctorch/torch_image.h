@@ -0,0 +1,74 @@
+// Copyright (c) 2023 Lynn <lynnplus90@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CTORCH_TORCH_IMAGE_H
+#define CTORCH_TORCH_IMAGE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#include "torch_core.h"
+#include "torch_tensor.h"
+
+typedef struct {
+    int top_pad;
+    int down_pad;
+    int left_pad;
+    int right_pad;
+    float scale;    // model input / source image
+    int src_width;  // source image size
+    int src_height;
+} TorchLetterboxInfo;
+
+/**
+ * decode a jpeg and letterbox it to width x height (RGB, scaled by 1/255, padded with 114),
+ * the jpeg is decoded with scaled idct (1/2, 1/4, 1/8) to the smallest size not below the letterbox size.
+ * thread safe, requires BUILD_WITH_JPEG
+ * @param data encoded jpeg
+ * @param size encoded size
+ * @param width model input width
+ * @param height model input height
+ * @param blob return float BHWC blob (free by the @torch_image_blob_delete when not needed)
+ * @param info return letterbox info, nullptr:not returned
+ * @param status
+ * @return 0:success 1:error
+ */
+CTORCH_PUBLIC int
+torch_image_decode_jpeg(const void *data, size_t size, int width, int height, TorchBlob *blob, TorchLetterboxInfo *info,
+                        TorchStatus *status);
+CTORCH_PUBLIC void torch_image_blob_delete(TorchBlob *blob);
+
+/**
+ * decode and letterbox a jpeg (see @torch_image_decode_jpeg) directly into the module input tensor and forward it
+ * @param inputType scalar type of the module input (Float, Half or BFloat16)
+ * @return output tensor (free by the @torch_tensor_delete), nullptr:error
+ */
+CTORCH_PUBLIC TorchTensor
+torch_module_forward_by_jpeg(TorchModule obj, const void *data, size_t size, int width, int height,
+                             TorchDevice *device, TorchScalarType inputType, TorchLetterboxInfo *info,
+                             TorchStatus *status);
+
+/**
+ * map boxes parsed from a letterboxed input back to source image coordinates
+ */
+CTORCH_PUBLIC void torch_image_restore_bbox(TensorResultBox *boxes, size_t size, TorchLetterboxInfo *info);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //CTORCH_TORCH_IMAGE_H
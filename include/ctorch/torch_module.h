@@ -29,6 +29,49 @@ extern "C" {
 CTORCH_PUBLIC TorchModule torch_module_load(const char *model_path, TorchStatus *status);
 CTORCH_PUBLIC void torch_module_delete(TorchModule obj);
 
+typedef struct {
+    TorchDevice device;     // device of the module and the warm-up input
+    bool half;              // convert the module and the warm-up input to half
+    bool bfloat16;          // convert the module and the warm-up input to bfloat16, ignored when half is set
+    bool optimize;          // freeze and optimize the module for inference
+    int warmup_iterations;  // forwards run on zeros after loading
+    int warmup_width;       // warm-up input size
+    int warmup_height;
+    const char *cache_dir;  // directory of the optimized module cache, nullptr:no cache
+} TorchLoadOptions;
+
+typedef struct {
+    bool cache_hit;         // the module was loaded from the cache dir
+    bool cache_saved;       // the module was missing in the cache dir and has been saved to it
+} TorchLoadInfo;
+
+/**
+ * load a model converted to the device/precision and optionally optimized for inference,
+ * use @torch_module_delete destroy.
+ * with a cache dir the converted (and frozen when optimize is set) module is saved keyed by the model content,
+ * libtorch version and options, later loads use it directly and only run the device specific optimization,
+ * a stale or corrupt cache entry is replaced by the normal load path
+ * @param model_path torchscript model path
+ * @param options load options, nullptr:same as @torch_module_load
+ * @param info receives how the cache was used, can be nullptr
+ * @param status
+ * @return
+ */
+CTORCH_PUBLIC TorchModule torch_module_load_optimized(const char *model_path, TorchLoadOptions *options,
+                                                      TorchLoadInfo *info, TorchStatus *status);
+
+/**
+ * create an execution replica of a loaded module, use @torch_module_delete destroy.
+ * parameters and buffers share storage with the source module, so the replica costs almost no memory,
+ * but a device or scalar conversion of any replica applies to all of them.
+ * each replica has its own methods and graph executors, lists, dicts and objects held as attributes are copied,
+ * so replicas can forward concurrently as long as forward does not modify a parameter or buffer in place.
+ * @param obj loaded module
+ * @param status
+ * @return
+ */
+CTORCH_PUBLIC TorchModule torch_module_clone_shared(TorchModule obj, TorchStatus *status);
+
 
 CTORCH_PUBLIC int torch_module_to_device(TorchModule obj, TorchDevice *device, bool non_blocking, TorchStatus *status);
 CTORCH_PUBLIC int torch_module_to_scalar(TorchModule obj, TorchScalarType st, bool non_blocking, TorchStatus *status);
@@ -36,6 +79,19 @@ CTORCH_PUBLIC int torch_module_to_scalar(TorchModule obj, TorchScalarType st, bo
 CTORCH_PUBLIC TorchIValue
 torch_module_forward_by_blob(TorchModule obj, TorchBlob *blob, TorchDevice *blobDevice, bool half);
 
+/**
+ * forward a BHWC blob, the blob is converted to the input type and BCHW layout in a single copy.
+ * for bfloat16 cpu inference convert the module with @torch_module_to_scalar(TorchScalarType_BFloat16)
+ * and pass a Byte blob with TorchScalarType_BFloat16 input type
+ * @param blobType scalar type of the blob data, Byte:scaled by 1/255, Float:used as is
+ * @param inputType scalar type of the module input (Float, Half or BFloat16)
+ * @param status
+ * @return output tensor (free by the @torch_tensor_delete), nullptr:error
+ */
+CTORCH_PUBLIC TorchTensor
+torch_module_forward_by_blob_typed(TorchModule obj, TorchBlob *blob, TorchScalarType blobType, TorchDevice *blobDevice,
+                                   TorchScalarType inputType, TorchStatus *status);
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,65 @@
+// Copyright (c) 2023 Lynn <lynnplus90@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CTORCH_TORCH_PROFILER_H
+#define CTORCH_TORCH_PROFILER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "torch_core.h"
+
+typedef struct {
+    bool record_shapes;  // record input shapes of each op
+    bool profile_memory; // record tensor allocations
+    bool with_stack;     // record source stack of each op
+} TorchProfilerOptions;
+
+typedef void *TorchProfilerRange;
+
+/**
+ * start the libtorch (kineto) profiler, ops run by the current thread are recorded until @torch_profiler_stop
+ * @param options profiler options, nullptr:only record op time
+ * @param status
+ * @return 0:success 1:error
+ */
+CTORCH_PUBLIC int torch_profiler_start(TorchProfilerOptions *options, TorchStatus *status);
+
+/**
+ * stop the profiler started by @torch_profiler_start
+ * @param trace_path chrome trace json output path, nullptr:not saved
+ * @param table return aggregated per-op table text sorted by self time (children excluded), nullptr:not generated
+ *        (free by the @torch_profiler_table_delete when not needed)
+ * @param status
+ * @return 0:success 1:error
+ */
+CTORCH_PUBLIC int torch_profiler_stop(const char *trace_path, char **table, TorchStatus *status);
+
+CTORCH_PUBLIC void torch_profiler_table_delete(char *table);
+
+/**
+ * begin a named range (e.g. preprocess, nms) on the profiler timeline, end it by @torch_profiler_range_pop
+ * on the same thread, ranges are cheap no-ops when the profiler is not running
+ * @param name range name
+ * @return range, nullptr:profiler not running (pop accepts nullptr)
+ */
+CTORCH_PUBLIC TorchProfilerRange torch_profiler_range_push(const char *name);
+CTORCH_PUBLIC void torch_profiler_range_pop(TorchProfilerRange range);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //CTORCH_TORCH_PROFILER_H
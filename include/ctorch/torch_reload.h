@@ -0,0 +1,102 @@
+// Copyright (c) 2023 Lynn <lynnplus90@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CTORCH_TORCH_RELOAD_H
+#define CTORCH_TORCH_RELOAD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "torch_core.h"
+#include "torch_module.h"
+
+typedef void *TorchReloadableModule;
+typedef void *TorchModuleLease;
+
+/**
+ * reload event callback, called on the reloading thread
+ * @param version swapped in version, 0:reload failed
+ * @param status error status of a failed reload, nullptr otherwise
+ */
+typedef void (*TorchReloadCallback)(void *user_data, uint64_t version, TorchStatus *status);
+
+typedef struct {
+    TorchLoadOptions load;  // options of every version load (see @torch_module_load_optimized), warm up before swap
+    TorchReloadCallback callback;
+    void *user_data;
+} TorchReloadOptions;
+
+typedef struct {
+    uint64_t version;        // current version, starts from 1
+    uint64_t swaps;          // successful reloads after the first load
+    uint64_t failed_reloads;
+    int loaded_versions;     // current version plus old versions still used by in-flight forwards or not yet freed
+    int64_t last_swap_ms;    // unix time of the last swap
+} TorchReloadInfo;
+
+/**
+ * load a model (version 1) into a handle whose model can be replaced while in use,
+ * use @torch_reloadable_module_delete destroy
+ * @param model_path torchscript model path
+ * @param options load options, nullptr:cpu, no optimization and no warm-up
+ * @param status
+ * @return
+ */
+CTORCH_PUBLIC TorchReloadableModule
+torch_reloadable_module_load(const char *model_path, TorchReloadOptions *options, TorchStatus *status);
+
+/**
+ * all leases must be released before delete
+ */
+CTORCH_PUBLIC void torch_reloadable_module_delete(TorchReloadableModule obj);
+
+/**
+ * load, optimize and warm up a new model, then atomically swap it in. forwards running on the old version
+ * finish on it. after its last lease is released the old version is freed by the next reload, info or delete call,
+ * never by the releasing thread. a failed reload keeps the current version
+ * @param async load on a background thread, the result is reported by the callback and @torch_reloadable_module_info,
+ * fails without waiting when an async reload is still running
+ * @return 0:success (or started when async) 1:error
+ */
+CTORCH_PUBLIC int
+torch_reloadable_module_reload(TorchReloadableModule obj, const char *model_path, bool async, TorchStatus *status);
+
+CTORCH_PUBLIC void torch_reloadable_module_info(TorchReloadableModule obj, TorchReloadInfo *info);
+
+/**
+ * pin the current version, use @torch_module_lease_release release
+ */
+CTORCH_PUBLIC TorchModuleLease torch_reloadable_module_acquire(TorchReloadableModule obj);
+
+/**
+ * module of the pinned version, valid until the lease is released (do not @torch_module_delete)
+ */
+CTORCH_PUBLIC TorchModule torch_module_lease_module(TorchModuleLease lease);
+CTORCH_PUBLIC uint64_t torch_module_lease_version(TorchModuleLease lease);
+CTORCH_PUBLIC void torch_module_lease_release(TorchModuleLease lease);
+
+/**
+ * @torch_module_forward_by_blob on the current version
+ */
+CTORCH_PUBLIC TorchTensor
+torch_reloadable_module_forward_by_blob(TorchReloadableModule obj, TorchBlob *blob, TorchDevice *blobDevice, bool half);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //CTORCH_TORCH_RELOAD_H
@@ -0,0 +1,122 @@
+// Copyright (c) 2023 Lynn <lynnplus90@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CTORCH_TORCH_SCHEDULER_H
+#define CTORCH_TORCH_SCHEDULER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "torch_core.h"
+#include "torch_tensor.h"
+
+typedef void *TorchScheduler;
+typedef void *TorchStream;
+
+typedef enum {
+    TorchFrameStatus_Done = 0,
+    TorchFrameStatus_Dropped = 1, // replaced by a newer frame of the same stream or the stream was deleted
+    TorchFrameStatus_Expired = 2, // deadline passed before the frame was scheduled
+    TorchFrameStatus_Failed = 3,  // inference error, see status
+} TorchFrameStatus;
+
+/**
+ * frame result callback, called on a scheduler worker thread (Dropped frames on the submitting thread).
+ * frames of one stream run one at a time, so Done/Expired/Failed callbacks of a stream never overlap
+ * and arrive in submission order
+ * @param boxes result boxes (no nms processing), only valid during the callback
+ * @param status error status of a Failed frame, nullptr otherwise
+ */
+typedef void (*TorchFrameCallback)(void *user_data, int64_t frame_id, TorchFrameStatus frame_status,
+                                   TensorResultBox *boxes, size_t size, TorchStatus *status);
+
+typedef struct {
+    int priority;   // streams with higher priority are always served first
+    float weight;   // share of workers between streams of the same priority, <=0:1
+    float confidence_threshold;
+    int max_result_size;
+} TorchStreamOptions;
+
+typedef struct {
+    size_t submitted;
+    size_t completed;
+    size_t dropped;
+    size_t expired;
+    size_t failed;
+} TorchStreamStats;
+
+/**
+ * create a scheduler with one worker thread per module, use @torch_scheduler_delete destroy.
+ * pass replicas from @torch_module_clone_shared (or the same module repeatedly) for concurrent workers
+ * @param modules loaded modules, must outlive the scheduler
+ * @param module_count number of modules (workers)
+ * @param device device of the input tensor
+ * @param half use half precision input
+ * @param status
+ * @return
+ */
+CTORCH_PUBLIC TorchScheduler
+torch_scheduler_new(TorchModule *modules, int module_count, TorchDevice *device, bool half, TorchStatus *status);
+
+/**
+ * stop the workers and delete the remaining streams (their queued frames are dropped)
+ */
+CTORCH_PUBLIC void torch_scheduler_delete(TorchScheduler obj);
+
+/**
+ * create a live stream, each stream keeps at most one queued frame (latest frame wins) besides the frame
+ * being processed, use @torch_stream_delete destroy
+ */
+CTORCH_PUBLIC TorchStream
+torch_stream_new(TorchScheduler scheduler, TorchStreamOptions *options, TorchFrameCallback callback, void *user_data);
+
+/**
+ * delete the stream, the queued frame is dropped and in-flight frames are waited for.
+ * can be called from the callback of the stream, the stream is then freed after the callback returns
+ */
+CTORCH_PUBLIC void torch_stream_delete(TorchStream obj);
+
+/**
+ * submit a frame (blob data is copied), a frame of this stream still queued is dropped
+ * @param frame_id passed to the callback
+ * @param deadline_ms frame expires when not scheduled within deadline_ms after submission, <=0:no deadline
+ * @return 0:success 1:error
+ */
+CTORCH_PUBLIC int
+torch_stream_submit(TorchStream obj, TorchBlob *blob, int64_t frame_id, int deadline_ms, TorchStatus *status);
+
+/**
+ * submit a jpeg frame (data is copied), it is decoded and letterboxed to width x height by a worker
+ * (see @torch_module_forward_by_jpeg) and the result boxes are in source image coordinates
+ * @param data encoded jpeg
+ * @param size encoded size
+ * @param width model input width
+ * @param height model input height
+ * @return 0:success 1:error (always when built without BUILD_WITH_JPEG)
+ */
+CTORCH_PUBLIC int
+torch_stream_submit_jpeg(TorchStream obj, const void *data, size_t size, int width, int height, int64_t frame_id,
+                         int deadline_ms, TorchStatus *status);
+
+CTORCH_PUBLIC void torch_stream_stats(TorchStream obj, TorchStreamStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //CTORCH_TORCH_SCHEDULER_H
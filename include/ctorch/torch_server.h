@@ -0,0 +1,82 @@
+// Copyright (c) 2023 Lynn <lynnplus90@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CTORCH_TORCH_SERVER_H
+#define CTORCH_TORCH_SERVER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#include "torch_core.h"
+#include "torch_tensor.h"
+
+typedef void *TorchServer;
+typedef void *TorchClient;
+
+typedef struct {
+    int max_batch_size; // maximum frames of different clients merged into one forward, <=1:no batching
+    int max_wait_us;    // maximum time to wait for more frames to fill a batch
+} TorchServerOptions;
+
+/**
+ * serve the module on a unix domain socket, frames are passed through shared memory (posix only),
+ * use @torch_server_stop destroy, the module must outlive the server
+ * @param socket_path unix domain socket path, an existing file is replaced
+ * @param module loaded module, only used by the server inference thread after start
+ * @param device device of the input tensor
+ * @param half use half precision input
+ * @param options server options, nullptr:no batching
+ * @param status
+ * @return
+ */
+CTORCH_PUBLIC TorchServer
+torch_server_start(const char *socket_path, TorchModule module, TorchDevice *device, bool half,
+                   TorchServerOptions *options, TorchStatus *status);
+CTORCH_PUBLIC void torch_server_stop(TorchServer obj);
+
+/**
+ * connect to a server started by @torch_server_start, use @torch_client_delete destroy
+ * @param socket_path unix domain socket path
+ * @param max_frame_bytes size of the shared frame buffer, the largest blob data size (float) to be sent
+ * @param max_result_size maximum number of result boxes per frame
+ * @param status
+ * @return
+ */
+CTORCH_PUBLIC TorchClient
+torch_client_connect(const char *socket_path, size_t max_frame_bytes, int max_result_size, TorchStatus *status);
+CTORCH_PUBLIC void torch_client_delete(TorchClient obj);
+
+/**
+ * shared frame buffer of the client, blob data written here directly is sent without copy
+ */
+CTORCH_PUBLIC void *torch_client_frame_buffer(TorchClient obj);
+
+/**
+ * remote version of forward + @torch_tensor_parse_to_bbox (no nms processing)
+ * @param max_result_size maximum number of result boxes return <=0:client limit
+ * @param output return bounding box array (free by the @torch_tensor_result_box_delete when not needed)
+ * @return >0:outputs size ==0:no result or outputs is nil <0:error(for detailed errors, can view status)
+ */
+CTORCH_PUBLIC size_t
+torch_client_detect(TorchClient obj, TorchBlob *blob, float confidence_threshold, int max_result_size,
+                    TensorResultBox **output, TorchStatus *status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //CTORCH_TORCH_SERVER_H
@@ -32,7 +32,7 @@ typedef struct {
 
 /**
  * parse a tensor to bounding box array(no nms processing)
- * @param obj tensor
+ * @param obj tensor (Float, Half or BFloat16)
  * @param confidence_threshold
  * @param max_result_size maximum number of result boxes return <=0:no limit
  * @param outputs return bounding box array (free by the @torch_tensor_result_box_delete when not needed)
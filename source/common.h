@@ -18,6 +18,7 @@
 #include <torch/script.h>
 #include <torch/torch.h>
 #include <ctorch/torch_core.h>
+#include <ctorch/torch_module.h>
 
 inline torch::Device torch_device_from_(TorchDevice *device) {
     if (device == nullptr || device->deviceType == TorchDeviceType_CPU) {
@@ -30,5 +31,18 @@ void torch_set_status(TorchStatus *status, std::exception &e, int code = 1);
 
 void torch_reset_status(TorchStatus *status);
 
+// load a model with the load options (see torch_module_load_optimized)
+torch::jit::Module torch_module_load_(const std::string &model_path, const TorchLoadOptions &options,
+                                       TorchLoadInfo *info = nullptr);
+
+// 128bit hash of the bytes (two 64bit lanes), h1 and h2 are the seeds and receive the result
+void torch_hash_bytes_(const void *data, size_t size, uint64_t &h1, uint64_t &h2);
+
+// remove the result cache entries of a module that is being deleted
+void torch_result_cache_purge_module_(const void *module);
+
+// forward a BCHW input tensor and return the first output tensor
+torch::Tensor torch_module_forward_input_(torch::jit::Module *mod, const torch::Tensor &input);
+
 
 #endif //CTORCH_COMMON_H
@@ -0,0 +1,261 @@
+// Copyright (c) 2023 Lynn <lynnplus90@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ctorch/torch_allocator.h"
+#include "common.h"
+
+#include <c10/core/CPUAllocator.h>
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+namespace {
+
+constexpr size_t block_round = 512;
+constexpr size_t shard_count = 16;
+constexpr size_t default_max_cached_bytes = size_t(256) << 20;
+
+thread_local int allocator_scope_depth = 0;
+
+struct Block {
+    void *data; // raw allocation of the original allocator
+    size_t size;
+    size_t shard; // free list the block returns to
+};
+
+// free lists are sharded by allocating thread, so threads do not contend on one lock
+struct FreeShard {
+    std::mutex mutex;
+    std::unordered_map<size_t, std::vector<Block *>> blocks;
+};
+
+// every block by data pointer, frees look blocks up here (sharded by pointer)
+struct IndexShard {
+    std::mutex mutex;
+    std::unordered_map<void *, Block *> blocks;
+};
+
+size_t thread_shard() {
+    static std::atomic<size_t> next_shard{0};
+    thread_local size_t shard = next_shard++ % shard_count;
+    return shard;
+}
+
+size_t pointer_shard(void *ptr) {
+    return size_t((uint64_t(reinterpret_cast<uintptr_t>(ptr)) * 0x9E3779B97F4A7C15ULL) >> 60) % shard_count;
+}
+
+class CachingCPUAllocator;
+
+CachingCPUAllocator *installed_allocator = nullptr; // never freed, tensors may outlive any scope
+
+class CachingCPUAllocator final : public c10::Allocator {
+public:
+    explicit CachingCPUAllocator(c10::Allocator *original) : original_(original) {}
+
+    // data pointer and context are the same for every DataPtr, so raw_allocate/raw_deallocate work as well
+    c10::DataPtr allocate(size_t n) override {
+        if (n == 0 || n < min_block_bytes_.load(std::memory_order_relaxed) ||
+            (!all_threads_.load(std::memory_order_relaxed) && allocator_scope_depth == 0)) {
+            return original_->allocate(n);
+        }
+
+        size_t size = (n + block_round - 1) / block_round * block_round;
+        size_t shard = thread_shard();
+        Block *block = nullptr;
+        {
+            auto &free_shard = free_shards_[shard];
+            std::lock_guard<std::mutex> lock(free_shard.mutex);
+            auto it = free_shard.blocks.find(size);
+            if (it != free_shard.blocks.end() && !it->second.empty()) {
+                block = it->second.back();
+                it->second.pop_back();
+            }
+        }
+        if (block != nullptr) {
+            reuses_++;
+            cached_bytes_ -= size;
+        } else {
+            block = new_block(size, shard);
+        }
+        allocations_++;
+        auto in_use = in_use_bytes_ += size;
+        auto peak = peak_bytes_.load();
+        while (in_use > peak && !peak_bytes_.compare_exchange_weak(peak, in_use)) {
+        }
+        return c10::DataPtr(block->data, block->data, &CachingCPUAllocator::free_ptr, c10::Device(c10::kCPU));
+    }
+
+    c10::DeleterFnPtr raw_deleter() const override {
+        return &CachingCPUAllocator::free_ptr;
+    }
+
+    void copy_data(void *dest, const void *src, std::size_t count) const override {
+        default_copy_data(dest, src, count);
+    }
+
+    void set_options(const TorchAllocatorOptions &options) {
+        max_cached_bytes_ = options.max_cached_bytes > 0 ? options.max_cached_bytes : default_max_cached_bytes;
+        min_block_bytes_ = options.min_block_bytes;
+        all_threads_ = options.all_threads;
+        trim(max_cached_bytes_);
+    }
+
+    TorchAllocatorStats stats() const {
+        return {allocations_.load(), reuses_.load(), in_use_bytes_.load(), peak_bytes_.load(), cached_bytes_.load()};
+    }
+
+    // release free blocks until at most limit bytes are cached
+    void trim(size_t limit) {
+        for (auto &free_shard: free_shards_) {
+            std::vector<Block *> released;
+            {
+                std::lock_guard<std::mutex> lock(free_shard.mutex);
+                for (auto &item: free_shard.blocks) {
+                    while (!item.second.empty() && cached_bytes_ > limit) {
+                        cached_bytes_ -= item.first;
+                        released.push_back(item.second.back());
+                        item.second.pop_back();
+                    }
+                }
+            }
+            for (auto block: released) {
+                delete_block(block);
+            }
+        }
+    }
+
+private:
+    Block *new_block(size_t size, size_t shard) {
+        auto block = new Block{nullptr, size, shard};
+        try {
+            block->data = original_->raw_allocate(size);
+            auto &index = index_shards_[pointer_shard(block->data)];
+            std::lock_guard<std::mutex> lock(index.mutex);
+            index.blocks.emplace(block->data, block);
+        } catch (...) {
+            if (block->data != nullptr) {
+                original_->raw_deallocate(block->data);
+            }
+            delete block;
+            throw;
+        }
+        return block;
+    }
+
+    void delete_block(Block *block) {
+        {
+            auto &index = index_shards_[pointer_shard(block->data)];
+            std::lock_guard<std::mutex> lock(index.mutex);
+            index.blocks.erase(block->data);
+        }
+        original_->raw_deallocate(block->data);
+        delete block;
+    }
+
+    static void free_ptr(void *ptr) {
+        auto self = installed_allocator;
+        Block *block = nullptr;
+        {
+            auto &index = self->index_shards_[pointer_shard(ptr)];
+            std::lock_guard<std::mutex> lock(index.mutex);
+            auto it = index.blocks.find(ptr);
+            if (it != index.blocks.end()) {
+                block = it->second;
+            }
+        }
+        if (block == nullptr) {
+            // raw allocation that bypassed the cache
+            self->original_->raw_deallocate(ptr);
+            return;
+        }
+
+        self->in_use_bytes_ -= block->size;
+        if (self->cached_bytes_ + block->size > self->max_cached_bytes_) {
+            self->delete_block(block);
+            return;
+        }
+        self->cached_bytes_ += block->size;
+        auto &free_shard = self->free_shards_[block->shard];
+        std::lock_guard<std::mutex> lock(free_shard.mutex);
+        free_shard.blocks[block->size].push_back(block);
+    }
+
+    c10::Allocator *original_;
+    std::atomic<size_t> max_cached_bytes_{default_max_cached_bytes};
+    std::atomic<size_t> min_block_bytes_{0};
+    std::atomic<bool> all_threads_{false};
+
+    std::atomic<size_t> allocations_{0};
+    std::atomic<size_t> reuses_{0};
+    std::atomic<size_t> in_use_bytes_{0};
+    std::atomic<size_t> peak_bytes_{0};
+    std::atomic<size_t> cached_bytes_{0};
+
+    std::array<FreeShard, shard_count> free_shards_;
+    std::array<IndexShard, shard_count> index_shards_;
+};
+
+std::mutex install_mutex;
+
+} // namespace
+
+int torch_cpu_allocator_install(TorchAllocatorOptions *options, TorchStatus *status) {
+    torch_reset_status(status);
+    try {
+        TorchAllocatorOptions opts{};
+        if (options != nullptr) {
+            opts = *options;
+        }
+        std::lock_guard<std::mutex> lock(install_mutex);
+        if (installed_allocator == nullptr) {
+            installed_allocator = new CachingCPUAllocator(c10::GetCPUAllocator());
+            installed_allocator->set_options(opts);
+            c10::SetCPUAllocator(installed_allocator, /*priority*/ 1);
+        } else {
+            installed_allocator->set_options(opts);
+        }
+        return 0;
+    } catch (std::exception &e) {
+        torch_set_status(status, e);
+        return 1;
+    }
+}
+
+void torch_cpu_allocator_scope_push(void) {
+    allocator_scope_depth++;
+}
+
+void torch_cpu_allocator_scope_pop(void) {
+    if (allocator_scope_depth > 0) {
+        allocator_scope_depth--;
+    }
+}
+
+void torch_cpu_allocator_stats(TorchAllocatorStats *stats) {
+    if (stats == nullptr) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(install_mutex);
+    *stats = installed_allocator != nullptr ? installed_allocator->stats() : TorchAllocatorStats{};
+}
+
+void torch_cpu_allocator_empty_cache(void) {
+    std::lock_guard<std::mutex> lock(install_mutex);
+    if (installed_allocator != nullptr) {
+        installed_allocator->trim(0);
+    }
+}
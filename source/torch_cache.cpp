@@ -0,0 +1,284 @@
+// Copyright (c) 2023 Lynn <lynnplus90@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ctorch/torch_cache.h"
+#include "ctorch/torch_module.h"
+#include "common.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+
+constexpr uint64_t hash_prime_1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t hash_prime_2 = 0xC2B2AE3D27D4EB4FULL;
+
+inline uint64_t hash_mix(uint64_t h, uint64_t v, uint64_t prime) {
+    h ^= v * prime;
+    h = (h << 31) | (h >> 33);
+    return h * hash_prime_1;
+}
+
+struct CacheKey {
+    uint64_t h1, h2;
+    const void *module;
+    int batchSize, channels, height, width;
+    bool half;
+    float confidence_threshold;
+    int max_result_size;
+
+    bool operator==(const CacheKey &o) const {
+        return h1 == o.h1 && h2 == o.h2 && module == o.module && batchSize == o.batchSize &&
+               channels == o.channels && height == o.height && width == o.width && half == o.half &&
+               confidence_threshold == o.confidence_threshold && max_result_size == o.max_result_size;
+    }
+};
+
+struct CacheKeyHash {
+    size_t operator()(const CacheKey &k) const {
+        return static_cast<size_t>(k.h1 ^ (k.h2 * hash_prime_2));
+    }
+};
+
+struct CacheEntry {
+    CacheKey key;
+    std::vector<TensorResultBox> boxes;
+};
+
+struct ResultCache {
+    TorchResultCacheOptions options{};
+    std::mutex mutex;
+    std::list<CacheEntry> lru; // front: most recently used
+    std::unordered_map<CacheKey, std::list<CacheEntry>::iterator, CacheKeyHash> index;
+    TorchResultCacheStats stats{};
+};
+
+// live caches, entries of a deleted module are purged so a module allocated at the same address never hits them
+std::mutex caches_mutex;
+std::unordered_set<ResultCache *> caches;
+
+inline size_t entry_bytes(const CacheEntry &entry) {
+    return sizeof(CacheEntry) + entry.boxes.size() * sizeof(TensorResultBox);
+}
+
+// blob data is float BHWC (same as torch_module_forward_by_blob), the exact hash reads it as 64bit words
+void hash_blob(const TorchBlob *blob, const TorchResultCacheOptions &options, uint64_t &h1, uint64_t &h2) {
+    size_t count = size_t(blob->batchSize) * blob->height * blob->width * blob->channels;
+    h1 = hash_prime_2 ^ count;
+    h2 = hash_prime_1 ^ count;
+    if (options.sample_stride <= 1 && options.tolerance <= 0) {
+        torch_hash_bytes_(blob->data, count * sizeof(float), h1, h2);
+        return;
+    }
+
+    // perceptual hash: average each stride x stride block (per pixel noise cancels out) and quantize the means
+    auto data = static_cast<const float *>(blob->data);
+    int stride = std::max(options.sample_stride, 1);
+    std::vector<float> sums(blob->channels);
+    for (int b = 0; b < blob->batchSize; ++b) {
+        for (int by = 0; by < blob->height; by += stride) {
+            int y_end = std::min(by + stride, blob->height);
+            for (int bx = 0; bx < blob->width; bx += stride) {
+                int x_end = std::min(bx + stride, blob->width);
+                std::fill(sums.begin(), sums.end(), 0.0f);
+                for (int y = by; y < y_end; ++y) {
+                    auto pixel = data + ((size_t(b) * blob->height + y) * blob->width + bx) * blob->channels;
+                    for (int x = bx; x < x_end; ++x, pixel += blob->channels) {
+                        for (int c = 0; c < blob->channels; ++c) {
+                            sums[c] += pixel[c];
+                        }
+                    }
+                }
+                float area = float((y_end - by) * (x_end - bx));
+                for (int c = 0; c < blob->channels; ++c) {
+                    float mean = sums[c] / area;
+                    uint64_t v;
+                    if (options.tolerance > 0) {
+                        v = static_cast<uint64_t>(static_cast<int64_t>(std::floor(mean / options.tolerance)));
+                    } else {
+                        uint32_t bits;
+                        std::memcpy(&bits, &mean, sizeof(bits));
+                        v = bits;
+                    }
+                    h1 = hash_mix(h1, v, hash_prime_2);
+                    h2 = hash_mix(h2, v, hash_prime_1);
+                }
+            }
+        }
+    }
+}
+
+size_t copy_boxes(const std::vector<TensorResultBox> &boxes, TensorResultBox **output) {
+    if (boxes.empty()) {
+        return 0;
+    }
+    auto data = (TensorResultBox *) malloc(sizeof(TensorResultBox) * boxes.size());
+    if (data == nullptr) {
+        throw std::bad_alloc();
+    }
+    std::memcpy(data, boxes.data(), sizeof(TensorResultBox) * boxes.size());
+    *output = data;
+    return boxes.size();
+}
+
+void evict_locked(ResultCache *cache) {
+    auto &options = cache->options;
+    while (!cache->lru.empty() && ((options.max_entries > 0 && cache->lru.size() > options.max_entries) ||
+                                   (options.max_bytes > 0 && cache->stats.bytes > options.max_bytes))) {
+        auto &last = cache->lru.back();
+        cache->stats.bytes -= entry_bytes(last);
+        cache->index.erase(last.key);
+        cache->lru.pop_back();
+        cache->stats.evictions++;
+    }
+    cache->stats.entries = cache->lru.size();
+}
+
+} // namespace
+
+TorchResultCache torch_result_cache_new(TorchResultCacheOptions *options) {
+    auto cache = new ResultCache();
+    if (options != nullptr) {
+        cache->options = *options;
+    }
+    std::lock_guard<std::mutex> lock(caches_mutex);
+    caches.insert(cache);
+    return cache;
+}
+
+void torch_result_cache_delete(TorchResultCache obj) {
+    auto cache = static_cast<ResultCache *>(obj);
+    {
+        std::lock_guard<std::mutex> lock(caches_mutex);
+        caches.erase(cache);
+    }
+    delete cache;
+}
+
+void torch_hash_bytes_(const void *data, size_t size, uint64_t &h1, uint64_t &h2) {
+    auto bytes = static_cast<const unsigned char *>(data);
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t v;
+        std::memcpy(&v, bytes + i, sizeof(v));
+        h1 = hash_mix(h1, v, hash_prime_2);
+        h2 = hash_mix(h2, v, hash_prime_1);
+    }
+    for (; i < size; ++i) {
+        h1 = hash_mix(h1, bytes[i], hash_prime_2);
+        h2 = hash_mix(h2, bytes[i], hash_prime_1);
+    }
+}
+
+void torch_result_cache_purge_module_(const void *module) {
+    std::lock_guard<std::mutex> lock(caches_mutex);
+    for (auto cache: caches) {
+        std::lock_guard<std::mutex> cache_lock(cache->mutex);
+        for (auto it = cache->lru.begin(); it != cache->lru.end();) {
+            if (it->key.module == module) {
+                cache->stats.bytes -= entry_bytes(*it);
+                cache->index.erase(it->key);
+                it = cache->lru.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        cache->stats.entries = cache->lru.size();
+    }
+}
+
+void torch_result_cache_clear(TorchResultCache obj) {
+    auto cache = static_cast<ResultCache *>(obj);
+    std::lock_guard<std::mutex> lock(cache->mutex);
+    cache->lru.clear();
+    cache->index.clear();
+    cache->stats.entries = 0;
+    cache->stats.bytes = 0;
+}
+
+void torch_result_cache_stats(TorchResultCache obj, TorchResultCacheStats *stats) {
+    auto cache = static_cast<ResultCache *>(obj);
+    if (stats == nullptr) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(cache->mutex);
+    *stats = cache->stats;
+}
+
+size_t
+torch_result_cache_detect(TorchResultCache obj, TorchModule module, TorchBlob *blob, TorchDevice *blobDevice,
+                          bool half, float confidence_threshold, int max_result_size, TensorResultBox **output,
+                          TorchStatus *status) {
+    auto cache = static_cast<ResultCache *>(obj);
+    torch_reset_status(status);
+    if (output == nullptr) {
+        return 0;
+    }
+    try {
+        CacheKey key{0, 0, module, blob->batchSize, blob->channels, blob->height, blob->width, half,
+                     confidence_threshold, max_result_size};
+        if (cache != nullptr) {
+            hash_blob(blob, cache->options, key.h1, key.h2);
+            std::lock_guard<std::mutex> lock(cache->mutex);
+            auto it = cache->index.find(key);
+            if (it != cache->index.end()) {
+                cache->lru.splice(cache->lru.begin(), cache->lru, it->second);
+                cache->stats.hits++;
+                return copy_boxes(it->second->boxes, output);
+            }
+            cache->stats.misses++;
+        }
+
+        auto tensor = torch_module_forward_by_blob(module, blob, blobDevice, half);
+        TensorResultBox *boxes = nullptr;
+        auto len = torch_tensor_parse_to_bbox(tensor, confidence_threshold, max_result_size, &boxes, status);
+        torch_tensor_delete(tensor);
+        if (len == (size_t) -1) {
+            return -1;
+        }
+        if (cache != nullptr) {
+            try {
+                CacheEntry entry{key, std::vector<TensorResultBox>(boxes, boxes + len)};
+                std::lock_guard<std::mutex> lock(cache->mutex);
+                if (cache->index.find(key) == cache->index.end()) {
+                    cache->lru.push_front(std::move(entry));
+                    try {
+                        cache->index.emplace(key, cache->lru.begin());
+                    } catch (...) {
+                        cache->lru.pop_front();
+                        throw;
+                    }
+                    cache->stats.bytes += entry_bytes(cache->lru.front());
+                    evict_locked(cache);
+                }
+            } catch (...) {
+                torch_tensor_result_box_delete(boxes);
+                throw;
+            }
+        }
+        // only hand out the boxes once nothing can fail
+        if (len > 0) {
+            *output = boxes;
+        }
+        return len;
+    } catch (std::exception &e) {
+        torch_set_status(status, e);
+        return -1;
+    }
+}
@@ -0,0 +1,281 @@
+// Copyright (c) 2023 Lynn <lynnplus90@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ctorch/torch_image.h"
+#include "common.h"
+
+#ifdef CTORCH_WITH_JPEG
+
+#include <algorithm>
+#include <cmath>
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+
+#include <jpeglib.h>
+
+namespace {
+
+struct JpegError {
+    jpeg_error_mgr mgr;
+    jmp_buf jump;
+    char msg[JMSG_LENGTH_MAX];
+};
+
+void jpeg_error_exit(j_common_ptr cinfo) {
+    auto error = reinterpret_cast<JpegError *>(cinfo->err);
+    (*cinfo->err->format_message)(cinfo, error->msg);
+    longjmp(error->jump, 1);
+}
+
+void jpeg_output_message(j_common_ptr) {
+    // corrupt data warnings are not printed to stderr
+}
+
+// decode with the largest idct scale whose output still covers target_w x target_h of the letterbox,
+// no object with a destructor may be created between setjmp and the end of decoding
+bool jpeg_decode_scaled(const void *data, size_t size, int width, int height, std::vector<unsigned char> &pixels,
+                        int &out_width, int &out_height, int &src_width, int &src_height, char *msg) {
+    jpeg_decompress_struct cinfo{};
+    JpegError error{};
+    cinfo.err = jpeg_std_error(&error.mgr);
+    error.mgr.error_exit = jpeg_error_exit;
+    error.mgr.output_message = jpeg_output_message;
+    if (setjmp(error.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        std::strcpy(msg, error.msg);
+        return false;
+    }
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, const_cast<unsigned char *>(static_cast<const unsigned char *>(data)),
+                 static_cast<unsigned long>(size));
+    jpeg_read_header(&cinfo, TRUE);
+
+    src_width = int(cinfo.image_width);
+    src_height = int(cinfo.image_height);
+    float scale = std::min(float(width) / float(src_width), float(height) / float(src_height));
+    auto unpad_w = std::lround(float(src_width) * scale);
+    auto unpad_h = std::lround(float(src_height) * scale);
+
+    cinfo.out_color_space = JCS_RGB;
+    cinfo.scale_num = 1;
+    for (unsigned int denom = 8; denom >= 1; denom /= 2) {
+        cinfo.scale_denom = denom;
+        jpeg_calc_output_dimensions(&cinfo);
+        if (long(cinfo.output_width) >= unpad_w && long(cinfo.output_height) >= unpad_h) {
+            break;
+        }
+    }
+
+    jpeg_start_decompress(&cinfo);
+    out_width = int(cinfo.output_width);
+    out_height = int(cinfo.output_height);
+    size_t stride = size_t(out_width) * cinfo.output_components;
+    try {
+        pixels.resize(stride * out_height);
+    } catch (...) {
+        jpeg_destroy_decompress(&cinfo);
+        throw;
+    }
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = pixels.data() + stride * cinfo.output_scanline;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return true;
+}
+
+struct BilinearTap {
+    int i0, i1;
+    float l1;
+};
+
+// source taps of a bilinear resize with align_corners=false (same as torch interpolate)
+std::vector<BilinearTap> bilinear_taps(int in_size, int out_size) {
+    std::vector<BilinearTap> taps(out_size);
+    float ratio = float(in_size) / float(out_size);
+    for (int i = 0; i < out_size; i++) {
+        float src = std::max((float(i) + 0.5f) * ratio - 0.5f, 0.0f);
+        int i0 = std::min(int(src), in_size - 1);
+        taps[i] = {i0, std::min(i0 + 1, in_size - 1), src - float(i0)};
+    }
+    return taps;
+}
+
+// resize, pad with 114 and normalize the RGB pixels into a BCHW input in one pass
+template<typename T>
+void letterbox_fill(const unsigned char *pixels, int src_w, int src_h, int new_w, int new_h, int top, int left,
+                    int width, int height, T *out) {
+    auto x_taps = bilinear_taps(src_w, new_w);
+    auto y_taps = bilinear_taps(src_h, new_h);
+    const T pad = T(114.0f / 255.0f);
+    const size_t plane = size_t(width) * height;
+    at::parallel_for(0, height, 16, [&](int64_t begin, int64_t end) {
+        for (auto y = begin; y < end; y++) {
+            T *rows[3] = {out + y * width, out + plane + y * width, out + 2 * plane + y * width};
+            int sy = int(y) - top;
+            if (sy < 0 || sy >= new_h) {
+                for (auto row: rows) {
+                    std::fill(row, row + width, pad);
+                }
+                continue;
+            }
+            for (auto row: rows) {
+                std::fill(row, row + left, pad);
+                std::fill(row + left + new_w, row + width, pad);
+            }
+            auto ty = y_taps[sy];
+            const unsigned char *r0 = pixels + size_t(ty.i0) * src_w * 3;
+            const unsigned char *r1 = pixels + size_t(ty.i1) * src_w * 3;
+            for (int x = 0; x < new_w; x++) {
+                auto tx = x_taps[x];
+                float w00 = (1.0f - ty.l1) * (1.0f - tx.l1), w01 = (1.0f - ty.l1) * tx.l1;
+                float w10 = ty.l1 * (1.0f - tx.l1), w11 = ty.l1 * tx.l1;
+                for (int c = 0; c < 3; c++) {
+                    float v = w00 * r0[tx.i0 * 3 + c] + w01 * r0[tx.i1 * 3 + c] +
+                              w10 * r1[tx.i0 * 3 + c] + w11 * r1[tx.i1 * 3 + c];
+                    rows[c][left + x] = T(v / 255.0f);
+                }
+            }
+        }
+    });
+}
+
+bool letterbox_type(torch::ScalarType type) {
+    return type == torch::kFloat || type == torch::kDouble || type == torch::kHalf || type == torch::kBFloat16;
+}
+
+// BCHW cpu input tensor of the letterboxed jpeg, type must be a floating type
+torch::Tensor jpeg_to_input(const void *data, size_t size, int width, int height, torch::ScalarType type,
+                            TorchLetterboxInfo *info) {
+    if (data == nullptr || size == 0 || width <= 0 || height <= 0) {
+        throw std::invalid_argument("invalid jpeg data or input size");
+    }
+    std::vector<unsigned char> pixels;
+    int decoded_w, decoded_h, src_w, src_h;
+    char msg[JMSG_LENGTH_MAX];
+    if (!jpeg_decode_scaled(data, size, width, height, pixels, decoded_w, decoded_h, src_w, src_h, msg)) {
+        throw std::runtime_error(std::string("decode jpeg fail:") + msg);
+    }
+
+    float scale = std::min(float(width) / float(src_w), float(height) / float(src_h));
+    int new_unpad_w = std::max(int(std::round(float(src_w) * scale)), 1);
+    int new_unpad_h = std::max(int(std::round(float(src_h) * scale)), 1);
+
+    float dw = float(width - new_unpad_w) / 2.0f;
+    float dh = float(height - new_unpad_h) / 2.0f;
+    int top = int(std::round(dh - 0.1f));
+    int down = int(std::round(dh + 0.1f));
+    int left = int(std::round(dw - 0.1f));
+    int right = int(std::round(dw + 0.1f));
+
+    auto img = torch::empty({1, 3, height, width}, torch::TensorOptions().dtype(type));
+    AT_DISPATCH_FLOATING_TYPES_AND2(at::kHalf, at::kBFloat16, type, "jpeg_to_input", [&] {
+        letterbox_fill<scalar_t>(pixels.data(), decoded_w, decoded_h, new_unpad_w, new_unpad_h, top, left, width,
+                                 height, img.data_ptr<scalar_t>());
+    });
+
+    if (info != nullptr) {
+        *info = {top, down, left, right, scale, src_w, src_h};
+    }
+    return img;
+}
+
+} // namespace
+
+int
+torch_image_decode_jpeg(const void *data, size_t size, int width, int height, TorchBlob *blob, TorchLetterboxInfo *info,
+                        TorchStatus *status) {
+    torch_reset_status(status);
+    try {
+        if (blob == nullptr) {
+            throw std::invalid_argument("blob is null");
+        }
+        auto img = jpeg_to_input(data, size, width, height, torch::kFloat, info).permute({0, 2, 3, 1}).contiguous();
+        auto bytes = size_t(img.numel()) * sizeof(float);
+        auto buffer = malloc(bytes);
+        if (buffer == nullptr) {
+            throw std::bad_alloc();
+        }
+        std::memcpy(buffer, img.data_ptr<float>(), bytes);
+        *blob = {buffer, 1, 3, height, width};
+        return 0;
+    } catch (std::exception &e) {
+        torch_set_status(status, e);
+        return 1;
+    }
+}
+
+TorchTensor
+torch_module_forward_by_jpeg(TorchModule obj, const void *data, size_t size, int width, int height,
+                             TorchDevice *device, TorchScalarType inputType, TorchLetterboxInfo *info,
+                             TorchStatus *status) {
+    torch_reset_status(status);
+    try {
+        auto mod = static_cast<torch::jit::Module *>(obj);
+        auto type = torch::ScalarType(inputType);
+        if (!c10::isFloatingType(type)) {
+            throw std::invalid_argument("input type is not a floating type");
+        }
+        auto input = jpeg_to_input(data, size, width, height, letterbox_type(type) ? type : torch::kFloat, info)
+                .to(torch_device_from_(device), type);
+        return new torch::Tensor(torch_module_forward_input_(mod, input));
+    } catch (std::exception &e) {
+        torch_set_status(status, e);
+        return nullptr;
+    }
+}
+
+#else
+
+int
+torch_image_decode_jpeg(const void *data, size_t size, int width, int height, TorchBlob *blob, TorchLetterboxInfo *info,
+                        TorchStatus *status) {
+    torch_reset_status(status);
+    std::runtime_error e("ctorch is built without jpeg support (BUILD_WITH_JPEG)");
+    torch_set_status(status, e);
+    return 1;
+}
+
+TorchTensor
+torch_module_forward_by_jpeg(TorchModule obj, const void *data, size_t size, int width, int height,
+                             TorchDevice *device, TorchScalarType inputType, TorchLetterboxInfo *info,
+                             TorchStatus *status) {
+    torch_reset_status(status);
+    std::runtime_error e("ctorch is built without jpeg support (BUILD_WITH_JPEG)");
+    torch_set_status(status, e);
+    return nullptr;
+}
+
+#endif
+
+void torch_image_blob_delete(TorchBlob *blob) {
+    if (blob != nullptr && blob->data != nullptr) {
+        free(blob->data);
+        blob->data = nullptr;
+    }
+}
+
+void torch_image_restore_bbox(TensorResultBox *boxes, size_t size, TorchLetterboxInfo *info) {
+    if (boxes == nullptr || info == nullptr || info->scale <= 0) {
+        return;
+    }
+    for (size_t i = 0; i < size; ++i) {
+        boxes[i].centerX = (boxes[i].centerX - float(info->left_pad)) / info->scale;
+        boxes[i].centerY = (boxes[i].centerY - float(info->top_pad)) / info->scale;
+        boxes[i].width /= info->scale;
+        boxes[i].height /= info->scale;
+    }
+}
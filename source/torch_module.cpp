@@ -29,9 +29,52 @@ TorchModule torch_module_load(const char *model_path, TorchStatus *status) {
 
 void torch_module_delete(TorchModule obj) {
     auto mod = static_cast<torch::jit::Module *>(obj);
+    torch_result_cache_purge_module_(mod);
     delete mod;
 }
 
+namespace {
+
+// inplace clone keeps every attribute value, lists/dicts/objects that forward may update (e.g. the grids of a
+// scripted detect head) are deep copied per replica, tensors inside them stay shared
+void unshare_attributes(torch::jit::Module &module) {
+    for (auto sub: module.modules()) {
+        auto object = sub._ivalue();
+        auto type = object->type();
+        for (size_t i = 0; i < type->numAttributes(); ++i) {
+            auto value = object->getSlot(i);
+            if (type->getAttribute(i)->is_module() ||
+                !(value.isList() || value.isGenericDict() || value.isTuple() || value.isObject())) {
+                continue;
+            }
+            c10::IValue::HashIdentityIValueMap memo;
+            value.visit([&memo](const c10::IValue &v) {
+                if (v.isTensor()) {
+                    memo[v] = v;
+                }
+                return false;
+            });
+            object->setSlot(i, value.deepcopy(memo));
+        }
+    }
+}
+
+} // namespace
+
+TorchModule torch_module_clone_shared(TorchModule obj, TorchStatus *status) {
+    torch_reset_status(status);
+    try {
+        auto mod = static_cast<torch::jit::Module *>(obj);
+        // inplace clone copies the module types and methods but keeps the attribute values (tensors)
+        auto replica = mod->clone(true);
+        unshare_attributes(replica);
+        return new torch::jit::Module(std::move(replica));
+    } catch (std::exception &e) {
+        torch_set_status(status, e);
+        return nullptr;
+    }
+}
+
 int torch_module_to_device(TorchModule obj, TorchDevice *device, bool non_blocking, TorchStatus *status) {
     torch_reset_status(status);
     if (device != nullptr) {
@@ -63,19 +106,52 @@ int torch_module_to_scalar(TorchModule obj, TorchScalarType st, bool non_blockin
 }
 
 
-TorchTensor torch_module_forward_by_blob(TorchModule obj, TorchBlob *blob, TorchDevice *blobDevice, bool half) {
-    auto mod = static_cast<torch::jit::Module *>(obj);
-    auto device = torch_device_from_(blobDevice);
-    auto tensor_img = torch::from_blob(blob->data, {blob->batchSize, blob->height, blob->width, blob->channels}).to(
-            device);
-    if (half) {
-        tensor_img = tensor_img.to(torch::kHalf);
+static torch::Tensor
+torch_module_forward_blob_(torch::jit::Module *mod, TorchBlob *blob, torch::ScalarType blobType,
+                           TorchDevice *blobDevice, torch::ScalarType inputType) {
+    if (!c10::isFloatingType(inputType)) {
+        throw std::invalid_argument("input type is not a floating type");
     }
+    torch::Tensor tensor_img;
+    {
+        RECORD_USER_SCOPE("ctorch::blob_to_input");
+        tensor_img = torch::from_blob(blob->data, {blob->batchSize, blob->height, blob->width, blob->channels},
+                                      torch::TensorOptions().dtype(blobType)).to(torch_device_from_(blobDevice));
 
-    tensor_img = tensor_img.permute({0, 3, 1, 2}).contiguous();  // BHWC -> BCHW (Batch, Channel, Height, Width)
+        // BHWC -> BCHW (Batch, Channel, Height, Width), the layout and type conversion share one copy
+        tensor_img = tensor_img.permute({0, 3, 1, 2}).to(inputType, false, false, torch::MemoryFormat::Contiguous);
+        if (blobType == torch::kByte) {
+            tensor_img.mul_(1.0 / 255.0);
+        }
+    }
+    return torch_module_forward_input_(mod, tensor_img);
+}
+
+torch::Tensor torch_module_forward_input_(torch::jit::Module *mod, const torch::Tensor &input) {
+    RECORD_USER_SCOPE("ctorch::forward");
     std::vector<torch::jit::IValue> inputs;
-    inputs.emplace_back(tensor_img);
+    inputs.emplace_back(input);
     torch::jit::IValue output = mod->forward(inputs);
-    auto tensor = output.toTuple()->elements()[0].toTensor();
+    return output.toTuple()->elements()[0].toTensor();
+}
+
+TorchTensor torch_module_forward_by_blob(TorchModule obj, TorchBlob *blob, TorchDevice *blobDevice, bool half) {
+    auto mod = static_cast<torch::jit::Module *>(obj);
+    auto tensor = torch_module_forward_blob_(mod, blob, torch::kFloat, blobDevice, half ? torch::kHalf : torch::kFloat);
     return new torch::Tensor(tensor);
+}
+
+TorchTensor
+torch_module_forward_by_blob_typed(TorchModule obj, TorchBlob *blob, TorchScalarType blobType, TorchDevice *blobDevice,
+                                   TorchScalarType inputType, TorchStatus *status) {
+    torch_reset_status(status);
+    try {
+        auto mod = static_cast<torch::jit::Module *>(obj);
+        auto tensor = torch_module_forward_blob_(mod, blob, torch::ScalarType(blobType), blobDevice,
+                                                 torch::ScalarType(inputType));
+        return new torch::Tensor(tensor);
+    } catch (std::exception &e) {
+        torch_set_status(status, e);
+        return nullptr;
+    }
 }
\ No newline at end of file
@@ -0,0 +1,182 @@
+// Copyright (c) 2023 Lynn <lynnplus90@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ctorch/torch_module.h"
+#include "common.h"
+
+#include <torch/version.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr const char *cache_key_file = "ctorch_cache_key";
+constexpr int cache_format_version = 3;
+
+uint64_t hash_finalize(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    return h ^ (h >> 33);
+}
+
+// 128bit hash as 32 hex digits
+std::string hash_hex(const std::string &data) {
+    uint64_t h1 = 0xC2B2AE3D27D4EB4FULL ^ data.size();
+    uint64_t h2 = 0x9E3779B185EBCA87ULL ^ data.size();
+    torch_hash_bytes_(data.data(), data.size(), h1, h2);
+    h1 = hash_finalize(h1 + h2);
+    h2 = hash_finalize(h2 + h1);
+    std::stringstream ss;
+    ss << std::hex << std::setfill('0') << std::setw(16) << h1 << std::setw(16) << h2;
+    return ss.str();
+}
+
+torch::ScalarType module_type(const TorchLoadOptions &options) {
+    return options.half ? torch::kHalf : options.bfloat16 ? torch::kBFloat16 : torch::kFloat;
+}
+
+std::string cache_key(const std::string &model, const TorchLoadOptions &options) {
+    std::stringstream ss;
+    ss << "format=" << cache_format_version
+       << ";model=" << hash_hex(model)
+       << ";torch=" << TORCH_VERSION
+       << ";device=" << options.device.deviceType << ":" << options.device.deviceIndex
+       << ";dtype=" << module_type(options)
+       << ";optimize=" << options.optimize;
+    return ss.str();
+}
+
+// the cached module, a stale or unreadable entry is removed
+c10::optional<torch::jit::Module> load_cache(const std::string &path, const std::string &key,
+                                             const torch::Device &device) {
+    if (!std::ifstream(path).good()) {
+        return c10::nullopt;
+    }
+    try {
+        torch::jit::ExtraFilesMap extra_files{{cache_key_file, ""}};
+        auto module = torch::jit::load(path, device, extra_files);
+        if (extra_files[cache_key_file] == key) {
+            return module;
+        }
+    } catch (std::exception &) {
+    }
+    std::remove(path.c_str());
+    return c10::nullopt;
+}
+
+bool save_cache(torch::jit::Module &module, const std::string &path, const std::string &key) {
+    // write to a temporary file first, concurrent loaders never see a partial entry
+    std::stringstream tmp;
+    tmp << path << ".tmp." << getpid() << "." << std::this_thread::get_id();
+    try {
+        torch::jit::ExtraFilesMap extra_files{{cache_key_file, key}};
+        module.save(tmp.str(), extra_files);
+        if (std::rename(tmp.str().c_str(), path.c_str()) == 0) {
+            return true;
+        }
+    } catch (std::exception &) {
+    }
+    std::remove(tmp.str().c_str());
+    return false;
+}
+
+void warm_up(torch::jit::Module &module, const torch::Device &device, const TorchLoadOptions &options) {
+    if (options.warmup_iterations <= 0 || options.warmup_width <= 0 || options.warmup_height <= 0) {
+        return;
+    }
+    auto input = torch::zeros({1, 3, options.warmup_height, options.warmup_width},
+                              torch::TensorOptions().device(device).dtype(module_type(options)));
+    for (int i = 0; i < options.warmup_iterations; ++i) {
+        torch_module_forward_input_(&module, input);
+    }
+}
+
+} // namespace
+
+torch::jit::Module torch_module_load_(const std::string &model_path, const TorchLoadOptions &options,
+                                       TorchLoadInfo *info) {
+    TorchDevice device_option = options.device;
+    auto device = torch_device_from_(&device_option);
+    TorchLoadInfo load_info{};
+
+    c10::optional<torch::jit::Module> module;
+    std::string key, cache_path;
+    if (options.cache_dir != nullptr) {
+        std::ifstream file(model_path, std::ios::binary);
+        if (!file) {
+            throw std::runtime_error("open model file fail:" + model_path);
+        }
+        std::string model((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        key = cache_key(model, options);
+        cache_path = std::string(options.cache_dir) + "/" + hash_hex(key) + ".ctorch.pt";
+        module = load_cache(cache_path, key, device);
+        load_info.cache_hit = module.has_value();
+        if (!module.has_value()) {
+            std::istringstream stream(model);
+            module = torch::jit::load(stream, device);
+        }
+    } else {
+        module = torch::jit::load(model_path, device);
+    }
+
+    if (!load_info.cache_hit) {
+        if (module_type(options) != torch::kFloat) {
+            module->to(module_type(options));
+        }
+        if (options.optimize) {
+            module->eval();
+            module = torch::jit::freeze(*module);
+        }
+        // the frozen module is cached, device specific rewrites (e.g. mkldnn) may not serialize
+        if (!cache_path.empty()) {
+            load_info.cache_saved = save_cache(*module, cache_path, key);
+        }
+    }
+    if (options.optimize) {
+        module = torch::jit::optimize_for_inference(*module);
+    }
+    warm_up(*module, device, options);
+    if (info != nullptr) {
+        *info = load_info;
+    }
+    return *module;
+}
+
+TorchModule torch_module_load_optimized(const char *model_path, TorchLoadOptions *options, TorchLoadInfo *info,
+                                        TorchStatus *status) {
+    torch_reset_status(status);
+    try {
+        TorchLoadOptions opts{};
+        if (options != nullptr) {
+            opts = *options;
+        }
+        return new torch::jit::Module(torch_module_load_(model_path, opts, info));
+    } catch (std::exception &e) {
+        torch_set_status(status, e);
+        return nullptr;
+    }
+}
@@ -0,0 +1,195 @@
+// Copyright (c) 2023 Lynn <lynnplus90@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ctorch/torch_profiler.h"
+#include "common.h"
+
+#include <torch/csrc/autograd/profiler_kineto.h>
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <sstream>
+
+namespace profiler = torch::autograd::profiler;
+
+namespace {
+
+struct OpStat {
+    uint64_t calls = 0;
+    uint64_t self_ns = 0;
+};
+
+std::string shapes_to_string(const c10::ArrayRef<std::vector<int64_t>> &shapes) {
+    std::stringstream ss;
+    ss << "[";
+    for (size_t i = 0; i < shapes.size(); ++i) {
+        ss << (i > 0 ? ", " : "") << "[";
+        for (size_t j = 0; j < shapes[i].size(); ++j) {
+            ss << (j > 0 ? ", " : "") << shapes[i][j];
+        }
+        ss << "]";
+    }
+    ss << "]";
+    return ss.str();
+}
+
+// self time of each event: its duration minus the durations of its direct children on the same thread
+std::vector<uint64_t> self_time_ns(const std::vector<const profiler::KinetoEvent *> &events) {
+    std::vector<size_t> order(events.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    // by thread, then by start time with parents (longer events) before their children
+    std::sort(order.begin(), order.end(), [&events](size_t a, size_t b) {
+        auto ea = events[a], eb = events[b];
+        if (ea->startThreadId() != eb->startThreadId()) {
+            return ea->startThreadId() < eb->startThreadId();
+        }
+        if (ea->startNs() != eb->startNs()) {
+            return ea->startNs() < eb->startNs();
+        }
+        return ea->durationNs() > eb->durationNs();
+    });
+
+    std::vector<uint64_t> self(events.size());
+    std::vector<size_t> stack;
+    for (auto i: order) {
+        auto event = events[i];
+        self[i] = event->durationNs();
+        while (!stack.empty() && (events[stack.back()]->startThreadId() != event->startThreadId() ||
+                                  events[stack.back()]->endNs() <= event->startNs())) {
+            stack.pop_back();
+        }
+        if (!stack.empty()) {
+            auto &parent = self[stack.back()];
+            parent -= std::min(parent, uint64_t(event->durationNs()));
+        }
+        stack.push_back(i);
+    }
+    return self;
+}
+
+std::string op_table(const profiler::ProfilerResult &result) {
+    std::map<std::string, OpStat> ops;
+    int64_t alloc_count = 0;
+    int64_t alloc_bytes = 0;
+    std::vector<const profiler::KinetoEvent *> events;
+    for (const auto &event: result.events()) {
+        if (event.name() == "[memory]") {
+            if (event.nBytes() > 0) {
+                alloc_count++;
+                alloc_bytes += event.nBytes();
+            }
+            continue;
+        }
+        events.push_back(&event);
+    }
+
+    auto self = self_time_ns(events);
+    for (size_t i = 0; i < events.size(); ++i) {
+        std::string key = events[i]->name();
+        if (events[i]->hasShapes() && !events[i]->shapes().empty()) {
+            key += " " + shapes_to_string(events[i]->shapes());
+        }
+        auto &stat = ops[key];
+        stat.calls++;
+        stat.self_ns += self[i];
+    }
+
+    std::vector<std::pair<std::string, OpStat>> sorted(ops.begin(), ops.end());
+    std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) {
+        return a.second.self_ns > b.second.self_ns;
+    });
+
+    std::stringstream ss;
+    ss << "self_us\tcalls\tavg_self_us\top\n";
+    for (const auto &item: sorted) {
+        ss << item.second.self_ns / 1000 << "\t" << item.second.calls << "\t"
+           << item.second.self_ns / 1000 / item.second.calls << "\t" << item.first << "\n";
+    }
+    if (alloc_count > 0) {
+        ss << "allocations:" << alloc_count << " bytes:" << alloc_bytes << "\n";
+    }
+    return ss.str();
+}
+
+} // namespace
+
+int torch_profiler_start(TorchProfilerOptions *options, TorchStatus *status) {
+    torch_reset_status(status);
+    try {
+        TorchProfilerOptions opts{};
+        if (options != nullptr) {
+            opts = *options;
+        }
+        torch::profiler::impl::ProfilerConfig config(torch::profiler::impl::ProfilerState::KINETO,
+                                                     opts.record_shapes, opts.profile_memory, opts.with_stack);
+        std::set<torch::profiler::impl::ActivityType> activities{torch::profiler::impl::ActivityType::CPU};
+        profiler::prepareProfiler(config, activities);
+        profiler::enableProfiler(config, activities);
+        return 0;
+    } catch (std::exception &e) {
+        torch_set_status(status, e);
+        return 1;
+    }
+}
+
+int torch_profiler_stop(const char *trace_path, char **table, TorchStatus *status) {
+    torch_reset_status(status);
+    try {
+        auto result = profiler::disableProfiler();
+        if (result == nullptr) {
+            throw std::runtime_error("profiler is not running");
+        }
+        if (trace_path != nullptr) {
+            result->save(trace_path);
+        }
+        if (table != nullptr) {
+            auto text = op_table(*result);
+            *table = (char *) malloc(text.size() + 1);
+            if (*table != nullptr) {
+                std::strcpy(*table, text.c_str());
+            }
+        }
+        return 0;
+    } catch (std::exception &e) {
+        torch_set_status(status, e);
+        return 1;
+    }
+}
+
+void torch_profiler_table_delete(char *table) {
+    if (table != nullptr) {
+        free(table);
+    }
+}
+
+TorchProfilerRange torch_profiler_range_push(const char *name) {
+    if (name == nullptr || !at::hasCallbacks()) {
+        return nullptr;
+    }
+    auto range = new at::RecordFunction(at::RecordScope::USER_SCOPE);
+    if (!range->isActive()) {
+        delete range;
+        return nullptr;
+    }
+    range->before(std::string(name));
+    return range;
+}
+
+void torch_profiler_range_pop(TorchProfilerRange range) {
+    auto record = static_cast<at::RecordFunction *>(range);
+    delete record;
+}
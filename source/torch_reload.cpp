@@ -0,0 +1,253 @@
+// Copyright (c) 2023 Lynn <lynnplus90@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ctorch/torch_reload.h"
+#include "ctorch/torch_module.h"
+#include "common.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+struct ModelVersion {
+    torch::jit::Module module;
+    uint64_t version;
+    std::atomic<int> *loaded_versions;
+    ModelVersion *next_retired = nullptr;
+
+    ModelVersion(torch::jit::Module module, uint64_t version, std::atomic<int> *loaded_versions)
+            : module(std::move(module)), version(version), loaded_versions(loaded_versions) {
+        (*loaded_versions)++;
+    }
+
+    ~ModelVersion() {
+        torch_result_cache_purge_module_(&module);
+        (*loaded_versions)--;
+    }
+};
+
+struct ModuleLease {
+    std::shared_ptr<ModelVersion> version;
+};
+
+struct ReloadableModule {
+    TorchReloadOptions options{};
+    std::string cache_dir; // owns options.load.cache_dir
+    std::shared_ptr<ModelVersion> current; // accessed by std::atomic_load/atomic_store only
+    std::atomic<int> loaded_versions{0};
+
+    std::mutex load_mutex; // serializes loads so only one new version is built at a time
+
+    std::mutex info_mutex; // guards the info fields, never held during a load
+    uint64_t next_version = 1;
+    uint64_t swaps = 0;
+    uint64_t failed_reloads = 0;
+    int64_t last_swap_ms = 0;
+
+    std::mutex thread_mutex;
+    std::thread reload_thread;
+    std::atomic<bool> reloading{false}; // an async reload is running
+
+    // versions whose last reference is gone, freed by reload/info/delete instead of the releasing
+    // (usually inference) thread
+    std::atomic<ModelVersion *> retired{nullptr};
+};
+
+// shared_ptr deleter of a version, only pushes it to the retired list (lock free, no allocation)
+struct RetireVersion {
+    ReloadableModule *handle;
+
+    void operator()(ModelVersion *version) const {
+        auto head = handle->retired.load();
+        do {
+            version->next_retired = head;
+        } while (!handle->retired.compare_exchange_weak(head, version));
+    }
+};
+
+void drain_retired(ReloadableModule *handle) {
+    auto version = handle->retired.exchange(nullptr);
+    while (version != nullptr) {
+        auto next = version->next_retired;
+        delete version;
+        version = next;
+    }
+}
+
+std::shared_ptr<ModelVersion> make_version(ReloadableModule *handle, torch::jit::Module module, uint64_t version) {
+    // if the control block allocation throws, shared_ptr retires the version itself
+    return {new ModelVersion(std::move(module), version, &handle->loaded_versions), RetireVersion{handle}};
+}
+
+int64_t unix_time_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+int reload(ReloadableModule *handle, const std::string &model_path, TorchStatus *status) {
+    uint64_t version = 0;
+    TorchStatus error;
+    torch_reset_status(&error);
+    std::shared_ptr<ModelVersion> previous; // released after the info lock
+    try {
+        std::lock_guard<std::mutex> load_lock(handle->load_mutex);
+        auto module = torch_module_load_(model_path, handle->options.load);
+
+        std::lock_guard<std::mutex> lock(handle->info_mutex);
+        auto loaded = make_version(handle, std::move(module), handle->next_version);
+        version = handle->next_version++;
+        // in-flight leases keep the old version alive until released
+        previous = std::atomic_exchange(&handle->current, loaded);
+        handle->swaps++;
+        handle->last_swap_ms = unix_time_ms();
+    } catch (std::exception &e) {
+        std::lock_guard<std::mutex> lock(handle->info_mutex);
+        handle->failed_reloads++;
+        torch_set_status(&error, e);
+    }
+    previous.reset();
+    drain_retired(handle);
+    if (handle->options.callback != nullptr) {
+        handle->options.callback(handle->options.user_data, version, version == 0 ? &error : nullptr);
+    }
+    if (version == 0) {
+        if (status != nullptr) {
+            *status = error;
+        } else {
+            torch_status_clear(&error);
+        }
+        return 1;
+    }
+    return 0;
+}
+
+} // namespace
+
+TorchReloadableModule
+torch_reloadable_module_load(const char *model_path, TorchReloadOptions *options, TorchStatus *status) {
+    torch_reset_status(status);
+    auto handle = new ReloadableModule();
+    try {
+        if (options != nullptr) {
+            handle->options = *options;
+        }
+        if (handle->options.load.cache_dir != nullptr) {
+            handle->cache_dir = handle->options.load.cache_dir;
+            handle->options.load.cache_dir = handle->cache_dir.c_str();
+        }
+        auto module = torch_module_load_(model_path, handle->options.load);
+        auto loaded = make_version(handle, std::move(module), handle->next_version++);
+        std::atomic_store(&handle->current, loaded);
+        handle->last_swap_ms = unix_time_ms();
+        return handle;
+    } catch (std::exception &e) {
+        torch_set_status(status, e);
+        delete handle;
+        return nullptr;
+    }
+}
+
+void torch_reloadable_module_delete(TorchReloadableModule obj) {
+    auto handle = static_cast<ReloadableModule *>(obj);
+    if (handle == nullptr) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(handle->thread_mutex);
+        if (handle->reload_thread.joinable()) {
+            handle->reload_thread.join();
+        }
+    }
+    std::atomic_store(&handle->current, std::shared_ptr<ModelVersion>());
+    drain_retired(handle);
+    delete handle;
+}
+
+int
+torch_reloadable_module_reload(TorchReloadableModule obj, const char *model_path, bool async, TorchStatus *status) {
+    auto handle = static_cast<ReloadableModule *>(obj);
+    torch_reset_status(status);
+    std::string path(model_path);
+    if (!async) {
+        return reload(handle, path, status);
+    }
+    std::lock_guard<std::mutex> lock(handle->thread_mutex);
+    if (handle->reloading.exchange(true)) {
+        std::runtime_error e("a reload is already running");
+        torch_set_status(status, e);
+        return 1;
+    }
+    try {
+        // the previous reload thread has finished, joining does not block
+        if (handle->reload_thread.joinable()) {
+            handle->reload_thread.join();
+        }
+        handle->reload_thread = std::thread([handle, path] {
+            reload(handle, path, nullptr);
+            handle->reloading = false;
+        });
+        return 0;
+    } catch (std::exception &e) {
+        handle->reloading = false;
+        torch_set_status(status, e);
+        return 1;
+    }
+}
+
+void torch_reloadable_module_info(TorchReloadableModule obj, TorchReloadInfo *info) {
+    auto handle = static_cast<ReloadableModule *>(obj);
+    if (info == nullptr) {
+        return;
+    }
+    drain_retired(handle);
+    std::lock_guard<std::mutex> lock(handle->info_mutex);
+    auto current = std::atomic_load(&handle->current);
+    info->version = current != nullptr ? current->version : 0;
+    info->swaps = handle->swaps;
+    info->failed_reloads = handle->failed_reloads;
+    info->loaded_versions = handle->loaded_versions;
+    info->last_swap_ms = handle->last_swap_ms;
+}
+
+TorchModuleLease torch_reloadable_module_acquire(TorchReloadableModule obj) {
+    auto handle = static_cast<ReloadableModule *>(obj);
+    return new ModuleLease{std::atomic_load(&handle->current)};
+}
+
+TorchModule torch_module_lease_module(TorchModuleLease lease) {
+    auto value = static_cast<ModuleLease *>(lease);
+    return &value->version->module;
+}
+
+uint64_t torch_module_lease_version(TorchModuleLease lease) {
+    auto value = static_cast<ModuleLease *>(lease);
+    return value->version->version;
+}
+
+void torch_module_lease_release(TorchModuleLease lease) {
+    auto value = static_cast<ModuleLease *>(lease);
+    delete value;
+}
+
+TorchTensor
+torch_reloadable_module_forward_by_blob(TorchReloadableModule obj, TorchBlob *blob, TorchDevice *blobDevice,
+                                        bool half) {
+    auto handle = static_cast<ReloadableModule *>(obj);
+    auto current = std::atomic_load(&handle->current);
+    return torch_module_forward_by_blob(&current->module, blob, blobDevice, half);
+}
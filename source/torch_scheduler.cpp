@@ -0,0 +1,370 @@
+// Copyright (c) 2023 Lynn <lynnplus90@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ctorch/torch_scheduler.h"
+#include "ctorch/torch_module.h"
+#include "ctorch/torch_allocator.h"
+#include "ctorch/torch_image.h"
+#include "common.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Frame {
+    std::vector<float> data;
+    std::vector<unsigned char> encoded; // jpeg frame, decoded by the worker to blob width x height
+    bool is_jpeg = false;
+    TorchBlob blob{};
+    int64_t id = 0;
+    bool has_deadline = false;
+    Clock::time_point deadline;
+};
+
+struct Scheduler;
+
+struct Stream {
+    Scheduler *scheduler = nullptr;
+    TorchStreamOptions options{};
+    TorchFrameCallback callback = nullptr;
+    void *user_data = nullptr;
+
+    // serializes submissions, staging is filled outside the scheduler lock
+    std::mutex submit_mutex;
+    Frame staging;
+
+    // guarded by the scheduler mutex
+    Frame pending;
+    bool has_pending = false;
+    int in_flight = 0;
+    bool deleted = false; // deleted from its own callback, the worker frees it after the callback
+    double virtual_time = 0; // weighted service received, the lowest is served first
+    TorchStreamStats stats{};
+};
+
+// stream whose frame the current worker thread is running
+thread_local Stream *running_stream = nullptr;
+
+struct Scheduler {
+    std::vector<torch::jit::Module *> modules;
+    TorchDevice device{};
+    bool half = false;
+
+    std::mutex mutex;
+    std::condition_variable work_cv;
+    std::condition_variable idle_cv;
+    std::vector<Stream *> streams;
+    double virtual_clock = 0;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+};
+
+void notify(Stream *stream, int64_t frame_id, TorchFrameStatus frame_status, TensorResultBox *boxes = nullptr,
+            size_t size = 0, TorchStatus *status = nullptr) {
+    if (stream->callback != nullptr) {
+        stream->callback(stream->user_data, frame_id, frame_status, boxes, size, status);
+    }
+}
+
+Stream *pick_stream_locked(Scheduler *scheduler) {
+    Stream *best = nullptr;
+    for (auto stream: scheduler->streams) {
+        // frames of a stream run one at a time, the queued frame keeps being replaced meanwhile
+        if (!stream->has_pending || stream->in_flight > 0) {
+            continue;
+        }
+        if (best == nullptr || stream->options.priority > best->options.priority ||
+            (stream->options.priority == best->options.priority && stream->virtual_time < best->virtual_time)) {
+            best = stream;
+        }
+    }
+    return best;
+}
+
+TorchFrameStatus run_frame(Scheduler *scheduler, torch::jit::Module *module, Stream *stream, Frame &frame) {
+    if (frame.has_deadline && Clock::now() > frame.deadline) {
+        notify(stream, frame.id, TorchFrameStatus_Expired);
+        return TorchFrameStatus_Expired;
+    }
+    TorchStatus status;
+    torch_reset_status(&status);
+    TensorResultBox *boxes = nullptr;
+    size_t len = -1;
+    try {
+        TorchLetterboxInfo info{};
+        TorchTensor tensor;
+        if (frame.is_jpeg) {
+            tensor = torch_module_forward_by_jpeg(module, frame.encoded.data(), frame.encoded.size(), frame.blob.width,
+                                                  frame.blob.height, &scheduler->device,
+                                                  scheduler->half ? TorchScalarType_Half : TorchScalarType_Float,
+                                                  &info, &status);
+        } else {
+            tensor = torch_module_forward_by_blob(module, &frame.blob, &scheduler->device, scheduler->half);
+        }
+        if (tensor != nullptr) {
+            len = torch_tensor_parse_to_bbox(tensor, stream->options.confidence_threshold,
+                                             stream->options.max_result_size, &boxes, &status);
+            torch_tensor_delete(tensor);
+        }
+        if (frame.is_jpeg && len != (size_t) -1) {
+            torch_image_restore_bbox(boxes, len, &info);
+        }
+    } catch (std::exception &e) {
+        torch_set_status(&status, e);
+        len = -1;
+    }
+    if (len == (size_t) -1) {
+        notify(stream, frame.id, TorchFrameStatus_Failed, nullptr, 0, &status);
+        torch_status_clear(&status);
+        return TorchFrameStatus_Failed;
+    }
+    notify(stream, frame.id, TorchFrameStatus_Done, boxes, len);
+    if (len > 0) {
+        torch_tensor_result_box_delete(boxes);
+    }
+    return TorchFrameStatus_Done;
+}
+
+void worker_loop(Scheduler *scheduler, torch::jit::Module *module) {
+    torch_cpu_allocator_scope_push();
+    Frame frame;
+    std::unique_lock<std::mutex> lock(scheduler->mutex);
+    while (true) {
+        Stream *stream = nullptr;
+        scheduler->work_cv.wait(lock, [&] {
+            return scheduler->stopping || (stream = pick_stream_locked(scheduler)) != nullptr;
+        });
+        if (scheduler->stopping) {
+            break;
+        }
+        // the pending slot takes the buffer of the previous frame, buffers are reused between frames
+        std::swap(frame, stream->pending);
+        frame.blob.data = frame.data.data();
+        stream->has_pending = false;
+        stream->in_flight++;
+        scheduler->virtual_clock = stream->virtual_time;
+        stream->virtual_time += 1.0 / (stream->options.weight > 0 ? stream->options.weight : 1.0f);
+        lock.unlock();
+
+        running_stream = stream;
+        auto frame_status = run_frame(scheduler, module, stream, frame);
+        running_stream = nullptr;
+
+        lock.lock();
+        if (stream->deleted) {
+            delete stream;
+            continue;
+        }
+        if (frame_status == TorchFrameStatus_Expired) {
+            stream->stats.expired++;
+        } else if (frame_status == TorchFrameStatus_Failed) {
+            stream->stats.failed++;
+        } else {
+            stream->stats.completed++;
+        }
+        stream->in_flight--;
+        scheduler->idle_cv.notify_all();
+    }
+    torch_cpu_allocator_scope_pop();
+}
+
+// remove the stream from the scheduler and return the id of its dropped frame
+bool detach_stream_locked(Scheduler *scheduler, Stream *stream, std::unique_lock<std::mutex> &lock,
+                          int64_t &dropped_id, bool wait) {
+    auto &streams = scheduler->streams;
+    streams.erase(std::remove(streams.begin(), streams.end(), stream), streams.end());
+    bool dropped = stream->has_pending;
+    if (dropped) {
+        dropped_id = stream->pending.id;
+        stream->has_pending = false;
+        stream->stats.dropped++;
+    }
+    if (wait) {
+        scheduler->idle_cv.wait(lock, [stream] { return stream->in_flight == 0; });
+    }
+    return dropped;
+}
+
+} // namespace
+
+TorchScheduler
+torch_scheduler_new(TorchModule *modules, int module_count, TorchDevice *device, bool half, TorchStatus *status) {
+    torch_reset_status(status);
+    try {
+        if (modules == nullptr || module_count <= 0) {
+            throw std::invalid_argument("no module for the scheduler");
+        }
+        auto scheduler = new Scheduler();
+        if (device != nullptr) {
+            scheduler->device = *device;
+        }
+        scheduler->half = half;
+        for (int i = 0; i < module_count; ++i) {
+            scheduler->modules.push_back(static_cast<torch::jit::Module *>(modules[i]));
+        }
+        for (auto module: scheduler->modules) {
+            scheduler->workers.emplace_back(worker_loop, scheduler, module);
+        }
+        return scheduler;
+    } catch (std::exception &e) {
+        torch_set_status(status, e);
+        return nullptr;
+    }
+}
+
+void torch_scheduler_delete(TorchScheduler obj) {
+    auto scheduler = static_cast<Scheduler *>(obj);
+    if (scheduler == nullptr) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(scheduler->mutex);
+        scheduler->stopping = true;
+    }
+    scheduler->work_cv.notify_all();
+    for (auto &worker: scheduler->workers) {
+        worker.join();
+    }
+    auto streams = scheduler->streams;
+    for (auto stream: streams) {
+        torch_stream_delete(stream);
+    }
+    delete scheduler;
+}
+
+TorchStream
+torch_stream_new(TorchScheduler obj, TorchStreamOptions *options, TorchFrameCallback callback, void *user_data) {
+    auto scheduler = static_cast<Scheduler *>(obj);
+    auto stream = new Stream();
+    stream->scheduler = scheduler;
+    if (options != nullptr) {
+        stream->options = *options;
+    }
+    stream->callback = callback;
+    stream->user_data = user_data;
+
+    std::lock_guard<std::mutex> lock(scheduler->mutex);
+    stream->virtual_time = scheduler->virtual_clock;
+    scheduler->streams.push_back(stream);
+    return stream;
+}
+
+void torch_stream_delete(TorchStream obj) {
+    auto stream = static_cast<Stream *>(obj);
+    if (stream == nullptr) {
+        return;
+    }
+    auto scheduler = stream->scheduler;
+    // called from the callback of the stream, its in-flight frame is the calling worker itself
+    bool own_callback = running_stream == stream;
+    int64_t dropped_id = 0;
+    bool dropped;
+    {
+        std::lock_guard<std::mutex> submit_lock(stream->submit_mutex);
+        std::unique_lock<std::mutex> lock(scheduler->mutex);
+        dropped = detach_stream_locked(scheduler, stream, lock, dropped_id, !own_callback);
+    }
+    if (dropped) {
+        notify(stream, dropped_id, TorchFrameStatus_Dropped);
+    }
+    if (own_callback) {
+        std::lock_guard<std::mutex> lock(scheduler->mutex);
+        stream->deleted = true;
+        return;
+    }
+    delete stream;
+}
+
+// fill the staging frame by fill_frame and queue it as the pending frame of the stream
+template<typename Fill>
+static int torch_stream_submit_(Stream *stream, int64_t frame_id, int deadline_ms, TorchStatus *status,
+                                Fill fill_frame) {
+    auto scheduler = stream->scheduler;
+    torch_reset_status(status);
+    int64_t dropped_id = 0;
+    bool dropped = false;
+    try {
+        std::lock_guard<std::mutex> submit_lock(stream->submit_mutex);
+        auto &frame = stream->staging;
+        fill_frame(frame);
+        frame.id = frame_id;
+        frame.has_deadline = deadline_ms > 0;
+        frame.deadline = Clock::now() + std::chrono::milliseconds(deadline_ms);
+
+        std::lock_guard<std::mutex> lock(scheduler->mutex);
+        if (stream->has_pending) {
+            // latest frame wins
+            dropped = true;
+            dropped_id = stream->pending.id;
+            stream->stats.dropped++;
+        } else if (stream->in_flight == 0 && stream->virtual_time < scheduler->virtual_clock) {
+            // an idle stream does not accumulate credit
+            stream->virtual_time = scheduler->virtual_clock;
+        }
+        std::swap(frame, stream->pending);
+        stream->has_pending = true;
+        stream->stats.submitted++;
+    } catch (std::exception &e) {
+        torch_set_status(status, e);
+        return 1;
+    }
+    scheduler->work_cv.notify_one();
+    if (dropped) {
+        notify(stream, dropped_id, TorchFrameStatus_Dropped);
+    }
+    return 0;
+}
+
+int torch_stream_submit(TorchStream obj, TorchBlob *blob, int64_t frame_id, int deadline_ms, TorchStatus *status) {
+    return torch_stream_submit_(static_cast<Stream *>(obj), frame_id, deadline_ms, status, [blob](Frame &frame) {
+        size_t size = size_t(blob->batchSize) * blob->channels * blob->height * blob->width;
+        frame.data.resize(size);
+        std::memcpy(frame.data.data(), blob->data, size * sizeof(float));
+        frame.is_jpeg = false;
+        frame.blob = *blob;
+    });
+}
+
+int torch_stream_submit_jpeg(TorchStream obj, const void *data, size_t size, int width, int height, int64_t frame_id,
+                             int deadline_ms, TorchStatus *status) {
+    return torch_stream_submit_(static_cast<Stream *>(obj), frame_id, deadline_ms, status, [=](Frame &frame) {
+#ifndef CTORCH_WITH_JPEG
+        // reject at submit time instead of failing every frame on a worker
+        throw std::runtime_error("ctorch is built without jpeg support (BUILD_WITH_JPEG)");
+#endif
+        if (data == nullptr || size == 0 || width <= 0 || height <= 0) {
+            throw std::invalid_argument("invalid jpeg data or input size");
+        }
+        auto bytes = static_cast<const unsigned char *>(data);
+        frame.encoded.assign(bytes, bytes + size);
+        frame.is_jpeg = true;
+        frame.blob = {nullptr, 1, 3, height, width};
+    });
+}
+
+void torch_stream_stats(TorchStream obj, TorchStreamStats *stats) {
+    auto stream = static_cast<Stream *>(obj);
+    if (stats == nullptr) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(stream->scheduler->mutex);
+    *stats = stream->stats;
+}
@@ -0,0 +1,616 @@
+// Copyright (c) 2023 Lynn <lynnplus90@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ctorch/torch_server.h"
+#include "ctorch/torch_module.h"
+#include "ctorch/torch_allocator.h"
+#include "common.h"
+
+#if defined _WIN32 || defined __CYGWIN__
+
+TorchServer torch_server_start(const char *socket_path, TorchModule module, TorchDevice *device, bool half,
+                               TorchServerOptions *options, TorchStatus *status) {
+    torch_reset_status(status);
+    std::runtime_error e("torch server is not supported on this platform");
+    torch_set_status(status, e);
+    return nullptr;
+}
+
+void torch_server_stop(TorchServer obj) {}
+
+TorchClient
+torch_client_connect(const char *socket_path, size_t max_frame_bytes, int max_result_size, TorchStatus *status) {
+    torch_reset_status(status);
+    std::runtime_error e("torch client is not supported on this platform");
+    torch_set_status(status, e);
+    return nullptr;
+}
+
+void torch_client_delete(TorchClient obj) {}
+
+void *torch_client_frame_buffer(TorchClient obj) {
+    return nullptr;
+}
+
+size_t torch_client_detect(TorchClient obj, TorchBlob *blob, float confidence_threshold, int max_result_size,
+                           TensorResultBox **output, TorchStatus *status) {
+    torch_reset_status(status);
+    std::runtime_error e("torch client is not supported on this platform");
+    torch_set_status(status, e);
+    return -1;
+}
+
+#else
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+// shared memory layout: [frame: frame_bytes][result: result_capacity * TensorResultBox]
+struct AttachMessage {
+    char shm_name[64];
+    uint64_t frame_bytes;
+    int32_t result_capacity;
+};
+
+struct RequestMessage {
+    int32_t batchSize, channels, height, width;
+    float confidence_threshold;
+    int32_t max_result_size;
+};
+
+struct ResponseMessage {
+    int32_t code;
+    int64_t count;
+    char msg[256];
+};
+
+bool send_all(int fd, const void *data, size_t size) {
+    auto p = static_cast<const char *>(data);
+    while (size > 0) {
+        auto n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= size_t(n);
+    }
+    return true;
+}
+
+bool recv_all(int fd, void *data, size_t size) {
+    auto p = static_cast<char *>(data);
+    while (size > 0) {
+        auto n = recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= size_t(n);
+    }
+    return true;
+}
+
+sockaddr_un socket_address(const char *socket_path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (socket_path == nullptr || std::strlen(socket_path) >= sizeof(addr.sun_path)) {
+        throw std::invalid_argument("invalid socket path");
+    }
+    std::strcpy(addr.sun_path, socket_path);
+    return addr;
+}
+
+std::runtime_error system_error(const std::string &what) {
+    return std::runtime_error(what + ":" + std::strerror(errno));
+}
+
+void set_response(ResponseMessage &response, int code, int64_t count, const char *msg) {
+    response.code = code;
+    response.count = count;
+    std::memset(response.msg, 0, sizeof(response.msg));
+    if (msg != nullptr) {
+        std::strncpy(response.msg, msg, sizeof(response.msg) - 1);
+    }
+}
+
+struct ServerJob {
+    TorchBlob blob;
+    float confidence_threshold;
+    int max_result_size;
+    TensorResultBox *result;
+    ResponseMessage response;
+    std::promise<void> done;
+};
+
+struct ServerConnection {
+    int fd = -1;
+    std::atomic<bool> finished{false};
+    std::thread thread;
+};
+
+struct Server {
+    std::string socket_path;
+    int listen_fd = -1;
+    torch::jit::Module *module = nullptr;
+    TorchDevice device{};
+    bool half = false;
+    TorchServerOptions options{};
+
+    std::atomic<bool> stopping{false};
+    bool inference_stopping = false; // guarded by queue_mutex, set after all connections are closed
+    std::thread accept_thread;
+    std::thread inference_thread;
+
+    std::mutex connections_mutex;
+    std::vector<std::unique_ptr<ServerConnection>> connections;
+
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+    std::deque<std::shared_ptr<ServerJob>> queue;
+};
+
+bool batch_compatible(const TorchBlob &a, const TorchBlob &b) {
+    return a.batchSize == 1 && b.batchSize == 1 && a.channels == b.channels && a.height == b.height &&
+           a.width == b.width;
+}
+
+void run_batch(Server *server, std::vector<std::shared_ptr<ServerJob>> &batch) {
+    TorchTensor output;
+    try {
+        TorchBlob blob = batch[0]->blob;
+        std::vector<float> staging;
+        if (batch.size() > 1) {
+            // frames of different clients live in different shared memory, merge them into one batch
+            size_t frame_size = size_t(blob.channels) * blob.height * blob.width;
+            staging.resize(frame_size * batch.size());
+            for (size_t i = 0; i < batch.size(); ++i) {
+                std::memcpy(staging.data() + i * frame_size, batch[i]->blob.data, frame_size * sizeof(float));
+            }
+            blob.data = staging.data();
+            blob.batchSize = int(batch.size());
+        }
+        output = torch_module_forward_by_blob(server->module, &blob, &server->device, server->half);
+    } catch (std::exception &e) {
+        for (auto &job: batch) {
+            set_response(job->response, 1, 0, e.what());
+            job->done.set_value();
+        }
+        return;
+    }
+
+    auto tensor = static_cast<torch::Tensor *>(output);
+    for (size_t i = 0; i < batch.size(); ++i) {
+        auto &job = batch[i];
+        torch::Tensor frame = batch.size() > 1 ? tensor->slice(0, int64_t(i), int64_t(i) + 1) : *tensor;
+        TensorResultBox *boxes = nullptr;
+        TorchStatus status;
+        auto len = torch_tensor_parse_to_bbox(&frame, job->confidence_threshold, job->max_result_size, &boxes,
+                                              &status);
+        if (len == (size_t) -1) {
+            set_response(job->response, status.code, 0, status.msg);
+            torch_status_clear(&status);
+        } else {
+            if (len > 0) {
+                std::memcpy(job->result, boxes, sizeof(TensorResultBox) * len);
+                torch_tensor_result_box_delete(boxes);
+            }
+            set_response(job->response, 0, int64_t(len), nullptr);
+        }
+        job->done.set_value();
+    }
+    torch_tensor_delete(output);
+}
+
+void inference_loop(Server *server) {
+    torch_cpu_allocator_scope_push();
+    int max_batch_size = std::max(server->options.max_batch_size, 1);
+    auto max_wait = std::chrono::microseconds(std::max(server->options.max_wait_us, 0));
+    while (true) {
+        std::vector<std::shared_ptr<ServerJob>> batch;
+        {
+            std::unique_lock<std::mutex> lock(server->queue_mutex);
+            server->queue_cv.wait(lock, [server] { return server->inference_stopping || !server->queue.empty(); });
+            if (server->queue.empty()) {
+                break;
+            }
+            batch.push_back(server->queue.front());
+            server->queue.pop_front();
+
+            auto deadline = std::chrono::steady_clock::now() + max_wait;
+            while (int(batch.size()) < max_batch_size && !server->inference_stopping) {
+                if (server->queue.empty() && !server->queue_cv.wait_until(lock, deadline, [server] {
+                    return server->inference_stopping || !server->queue.empty();
+                })) {
+                    break;
+                }
+                if (server->queue.empty() || !batch_compatible(batch[0]->blob, server->queue.front()->blob)) {
+                    break;
+                }
+                batch.push_back(server->queue.front());
+                server->queue.pop_front();
+            }
+        }
+        run_batch(server, batch);
+    }
+    torch_cpu_allocator_scope_pop();
+}
+
+// byte size of the frame in a request, 0 for a non-positive dim or an overflow
+size_t request_frame_bytes(const RequestMessage &request) {
+    if (request.batchSize <= 0 || request.channels <= 0 || request.height <= 0 || request.width <= 0) {
+        return 0;
+    }
+    size_t bytes = sizeof(float);
+    for (int32_t dim: {request.batchSize, request.channels, request.height, request.width}) {
+        if (__builtin_mul_overflow(bytes, size_t(dim), &bytes)) {
+            return 0;
+        }
+    }
+    return bytes;
+}
+
+void connection_serve(Server *server, int fd) {
+    AttachMessage attach{};
+    ResponseMessage response{};
+    if (!recv_all(fd, &attach, sizeof(attach))) {
+        return;
+    }
+    attach.shm_name[sizeof(attach.shm_name) - 1] = '\0';
+    size_t result_capacity = attach.result_capacity > 0 ? size_t(attach.result_capacity) : 0;
+    // the sizes come from the client, an overflowing layout must not pass the size check below
+    size_t result_bytes = 0, shm_size = 0;
+    bool overflow = __builtin_mul_overflow(result_capacity, sizeof(TensorResultBox), &result_bytes) ||
+                    __builtin_add_overflow(size_t(attach.frame_bytes), result_bytes, &shm_size);
+
+    int shm_fd = overflow ? -1 : shm_open(attach.shm_name, O_RDWR, 0600);
+    struct stat st{};
+    if (shm_fd < 0 || fstat(shm_fd, &st) != 0 || st.st_size < 0 || attach.frame_bytes > uint64_t(st.st_size) ||
+        result_bytes > uint64_t(st.st_size) || size_t(st.st_size) < shm_size) {
+        if (shm_fd >= 0) {
+            close(shm_fd);
+        }
+        set_response(response, 1, 0, "attach shared memory fail");
+        send_all(fd, &response, sizeof(response));
+        return;
+    }
+    void *shm = mmap(nullptr, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    close(shm_fd);
+    if (shm == MAP_FAILED) {
+        set_response(response, 1, 0, "map shared memory fail");
+        send_all(fd, &response, sizeof(response));
+        return;
+    }
+    set_response(response, 0, 0, nullptr);
+    if (!send_all(fd, &response, sizeof(response))) {
+        munmap(shm, shm_size);
+        return;
+    }
+
+    RequestMessage request{};
+    while (!server->stopping && recv_all(fd, &request, sizeof(request))) {
+        size_t frame_bytes = request_frame_bytes(request);
+        int max_result_size = request.max_result_size;
+        if (max_result_size <= 0 || size_t(max_result_size) > result_capacity) {
+            max_result_size = int(result_capacity);
+        }
+        if (frame_bytes == 0 || frame_bytes > attach.frame_bytes || max_result_size <= 0) {
+            set_response(response, 1, 0, "invalid request");
+        } else {
+            auto job = std::make_shared<ServerJob>();
+            job->blob = {shm, request.batchSize, request.channels, request.height, request.width};
+            job->confidence_threshold = request.confidence_threshold;
+            job->max_result_size = max_result_size;
+            job->result = reinterpret_cast<TensorResultBox *>(static_cast<char *>(shm) + attach.frame_bytes);
+            auto done = job->done.get_future();
+            {
+                std::lock_guard<std::mutex> lock(server->queue_mutex);
+                server->queue.push_back(job);
+            }
+            server->queue_cv.notify_one();
+            done.wait();
+            response = job->response;
+        }
+        if (!send_all(fd, &response, sizeof(response))) {
+            break;
+        }
+    }
+    munmap(shm, shm_size);
+}
+
+void connection_loop(Server *server, ServerConnection *connection) {
+    connection_serve(server, connection->fd);
+    connection->finished = true;
+}
+
+// join and remove connections whose client has disconnected
+void reap_connections(Server *server) {
+    auto &connections = server->connections;
+    for (auto it = connections.begin(); it != connections.end();) {
+        if ((*it)->finished) {
+            (*it)->thread.join();
+            close((*it)->fd);
+            it = connections.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+
+void accept_loop(Server *server) {
+    while (!server->stopping) {
+        int fd = accept(server->listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (server->stopping) {
+                break;
+            }
+            if (errno != EINTR && errno != ECONNABORTED) {
+                // e.g. EMFILE/ENFILE/ENOMEM, back off until resources are released
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(server->connections_mutex);
+        if (server->stopping) {
+            close(fd);
+            break;
+        }
+        reap_connections(server);
+        auto connection = std::make_unique<ServerConnection>();
+        connection->fd = fd;
+        auto ptr = connection.get();
+        connection->thread = std::thread(connection_loop, server, ptr);
+        server->connections.push_back(std::move(connection));
+    }
+}
+
+struct Client {
+    int fd = -1;
+    void *shm = nullptr;
+    size_t shm_size = 0;
+    size_t frame_bytes = 0;
+    int result_capacity = 0;
+    std::mutex mutex;
+};
+
+void client_close(Client *client) {
+    if (client->shm != nullptr) {
+        munmap(client->shm, client->shm_size);
+    }
+    if (client->fd >= 0) {
+        close(client->fd);
+    }
+    delete client;
+}
+
+} // namespace
+
+TorchServer torch_server_start(const char *socket_path, TorchModule module, TorchDevice *device, bool half,
+                               TorchServerOptions *options, TorchStatus *status) {
+    torch_reset_status(status);
+    auto server = new Server();
+    try {
+        auto addr = socket_address(socket_path);
+        server->socket_path = socket_path;
+        server->module = static_cast<torch::jit::Module *>(module);
+        server->half = half;
+        if (device != nullptr) {
+            server->device = *device;
+        }
+        if (options != nullptr) {
+            server->options = *options;
+        }
+
+        server->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (server->listen_fd < 0) {
+            throw system_error("create socket fail");
+        }
+        unlink(socket_path);
+        if (bind(server->listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+            throw system_error("bind socket fail");
+        }
+        if (listen(server->listen_fd, SOMAXCONN) != 0) {
+            throw system_error("listen socket fail");
+        }
+        server->inference_thread = std::thread(inference_loop, server);
+        server->accept_thread = std::thread(accept_loop, server);
+        return server;
+    } catch (std::exception &e) {
+        torch_set_status(status, e);
+        if (server->listen_fd >= 0) {
+            close(server->listen_fd);
+        }
+        delete server;
+        return nullptr;
+    }
+}
+
+void torch_server_stop(TorchServer obj) {
+    auto server = static_cast<Server *>(obj);
+    if (server == nullptr) {
+        return;
+    }
+    server->stopping = true;
+    shutdown(server->listen_fd, SHUT_RDWR);
+    server->accept_thread.join();
+    close(server->listen_fd);
+    unlink(server->socket_path.c_str());
+
+    {
+        std::lock_guard<std::mutex> lock(server->connections_mutex);
+        for (auto &connection: server->connections) {
+            shutdown(connection->fd, SHUT_RDWR);
+        }
+    }
+    // queued jobs are still completed, connection threads wait for them
+    for (auto &connection: server->connections) {
+        connection->thread.join();
+        close(connection->fd);
+    }
+    {
+        std::lock_guard<std::mutex> lock(server->queue_mutex);
+        server->inference_stopping = true;
+    }
+    server->queue_cv.notify_all();
+    server->inference_thread.join();
+    delete server;
+}
+
+TorchClient
+torch_client_connect(const char *socket_path, size_t max_frame_bytes, int max_result_size, TorchStatus *status) {
+    static std::atomic<int> shm_counter{0};
+    torch_reset_status(status);
+    auto client = new Client();
+    std::string shm_name;
+    try {
+        if (max_frame_bytes == 0 || max_result_size <= 0) {
+            throw std::invalid_argument("invalid frame bytes or result size");
+        }
+        auto addr = socket_address(socket_path);
+        client->frame_bytes = max_frame_bytes;
+        client->result_capacity = max_result_size;
+        client->shm_size = max_frame_bytes + size_t(max_result_size) * sizeof(TensorResultBox);
+
+        shm_name = "/ctorch-" + std::to_string(getpid()) + "-" + std::to_string(shm_counter++);
+        int shm_fd = shm_open(shm_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (shm_fd < 0) {
+            throw system_error("create shared memory fail");
+        }
+        if (ftruncate(shm_fd, off_t(client->shm_size)) != 0) {
+            close(shm_fd);
+            throw system_error("resize shared memory fail");
+        }
+        void *shm = mmap(nullptr, client->shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+        close(shm_fd);
+        if (shm == MAP_FAILED) {
+            throw system_error("map shared memory fail");
+        }
+        client->shm = shm;
+
+        client->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (client->fd < 0) {
+            throw system_error("create socket fail");
+        }
+        if (connect(client->fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+            throw system_error("connect socket fail");
+        }
+
+        AttachMessage attach{};
+        std::strncpy(attach.shm_name, shm_name.c_str(), sizeof(attach.shm_name) - 1);
+        attach.frame_bytes = max_frame_bytes;
+        attach.result_capacity = max_result_size;
+        ResponseMessage response{};
+        if (!send_all(client->fd, &attach, sizeof(attach)) || !recv_all(client->fd, &response, sizeof(response))) {
+            throw std::runtime_error("server connection closed");
+        }
+        if (response.code != 0) {
+            throw std::runtime_error(response.msg);
+        }
+        // both sides are mapped, the name is no longer needed
+        shm_unlink(shm_name.c_str());
+        return client;
+    } catch (std::exception &e) {
+        torch_set_status(status, e);
+        if (!shm_name.empty()) {
+            shm_unlink(shm_name.c_str());
+        }
+        client_close(client);
+        return nullptr;
+    }
+}
+
+void torch_client_delete(TorchClient obj) {
+    auto client = static_cast<Client *>(obj);
+    if (client != nullptr) {
+        client_close(client);
+    }
+}
+
+void *torch_client_frame_buffer(TorchClient obj) {
+    auto client = static_cast<Client *>(obj);
+    return client->shm;
+}
+
+size_t torch_client_detect(TorchClient obj, TorchBlob *blob, float confidence_threshold, int max_result_size,
+                           TensorResultBox **output, TorchStatus *status) {
+    auto client = static_cast<Client *>(obj);
+    torch_reset_status(status);
+    if (output == nullptr) {
+        return 0;
+    }
+    try {
+        std::lock_guard<std::mutex> lock(client->mutex);
+        RequestMessage request{blob->batchSize, blob->channels, blob->height, blob->width, confidence_threshold,
+                               max_result_size};
+        size_t frame_bytes = request_frame_bytes(request);
+        if (frame_bytes == 0) {
+            throw std::invalid_argument("invalid blob size");
+        }
+        if (frame_bytes > client->frame_bytes) {
+            throw std::invalid_argument("blob is larger than the client frame buffer");
+        }
+        if (blob->data != client->shm) {
+            std::memcpy(client->shm, blob->data, frame_bytes);
+        }
+
+        ResponseMessage response{};
+        if (!send_all(client->fd, &request, sizeof(request)) ||
+            !recv_all(client->fd, &response, sizeof(response))) {
+            throw std::runtime_error("server connection closed");
+        }
+        if (response.code != 0) {
+            response.msg[sizeof(response.msg) - 1] = '\0';
+            throw std::runtime_error(response.msg);
+        }
+        auto len = size_t(std::max<int64_t>(std::min<int64_t>(response.count, client->result_capacity), 0));
+        if (len == 0) {
+            return 0;
+        }
+        auto data = (TensorResultBox *) malloc(sizeof(TensorResultBox) * len);
+        if (data == nullptr) {
+            throw std::bad_alloc();
+        }
+        std::memcpy(data, static_cast<char *>(client->shm) + client->frame_bytes, sizeof(TensorResultBox) * len);
+        *output = data;
+        return len;
+    } catch (std::exception &e) {
+        torch_set_status(status, e);
+        return -1;
+    }
+}
+
+#endif
@@ -31,6 +31,7 @@ torch_tensor_parse_to_bbox(TorchTensor obj, float confidence_threshold, int max_
                            TorchStatus *status) {
     auto detections = static_cast<torch::Tensor *>(obj);
     torch_reset_status(status);
+    RECORD_USER_SCOPE("ctorch::parse_to_bbox");
     if (output == nullptr) {
         return 0;
     }
@@ -54,6 +55,8 @@ torch_tensor_parse_to_bbox(TorchTensor obj, float confidence_threshold, int max_
         if (candidate_object_tensor.size(0) == 0) {
             return 0;
         }
+        // half/bfloat16 outputs are filtered natively, only the candidates are upcast
+        candidate_object_tensor = candidate_object_tensor.to(torch::kFloat);
 
         at::Tensor class_score_tensor = candidate_object_tensor.slice(-1, 4, item_attr_size) *
                                         candidate_object_tensor.slice(-1, item_attr_size);